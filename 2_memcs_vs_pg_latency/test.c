@@ -9,7 +9,15 @@
 #include <stdbool.h>
 
 #include <netdb.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <netinet/tcp.h>
+#include <linux/io_uring.h>
 
 #include "msgpuck/msgpuck.h"
 
@@ -21,8 +29,10 @@
 
 #define IPROTO_REQUEST_TYPE	0x00
 #define IPROTO_SYNC		0x01
+#define IPROTO_SCHEMA_VERSION	0x05
 #define IPROTO_TUPLE		0x21
 #define IPROTO_FUNCTION_NAME	0x22
+#define IPROTO_ERROR_24		0x31
 
 #define IPROTO_call_16	0x06
 #define IPROTO_call	0x0a
@@ -133,7 +143,7 @@ get_unsigned(uint8_t *buf, int bytes)
 {
 	uint64_t result = 0;
 	for (int i = 0; i < bytes; i++)
-		result |= buf[i] >> (((bytes - 1) - i) * 8);
+		result |= (uint64_t)buf[i] << (((bytes - 1) - i) * 8);
 	return result;
 }
 
@@ -149,8 +159,223 @@ get_uint32(uint8_t *buf)
 	return get_unsigned(buf, 4);
 }
 
+/*
+ * The receive buffer of a connection: a ring mapped twice in a row, so
+ * the data from any position up to the capacity is contiguous and the
+ * frames are parsed in place, however they are wrapped.
+ */
+struct iproto_ring {
+	uint8_t *data;
+	/* A power of two multiple of the page size. */
+	size_t capacity;
+	/* The positions of the data received and not parsed yet. */
+	uint64_t head;
+	uint64_t tail;
+	/* The size of the frame being received, 0 if not known yet. */
+	size_t frame_size;
+};
+
+void
+iproto_ring_create(struct iproto_ring *ring, size_t capacity)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	memset(ring, 0, sizeof(*ring));
+	ring->capacity = page_size;
+	while (ring->capacity < capacity)
+		ring->capacity *= 2;
+	int fd = memfd_create("iproto_ring", 0);
+	if (fd == -1)
+		ERROR_SYS("Couldn't create the ring memory");
+	if (ftruncate(fd, ring->capacity) == -1)
+		ERROR_SYS("Couldn't size the ring memory");
+	/* Reserve the address space and map the memory twice into it. */
+	ring->data = mmap(NULL, 2 * ring->capacity, PROT_NONE,
+			  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring->data == MAP_FAILED)
+		ERROR_SYS("Couldn't reserve the ring address space");
+	for (int i = 0; i < 2; i++) {
+		if (mmap(&ring->data[i * ring->capacity], ring->capacity,
+			 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)
+			ERROR_SYS("Couldn't map the ring memory");
+	}
+	close(fd);
+}
+
+void
+iproto_ring_destroy(struct iproto_ring *ring)
+{
+	munmap(ring->data, 2 * ring->capacity);
+}
+
+/* The data received and not parsed yet. */
+static inline uint8_t *
+iproto_ring_rpos(struct iproto_ring *ring)
+{
+	return &ring->data[ring->head & (ring->capacity - 1)];
+}
+
+/* The free space to receive to, of iproto_ring_unused() bytes. */
+static inline uint8_t *
+iproto_ring_wpos(struct iproto_ring *ring)
+{
+	return &ring->data[ring->tail & (ring->capacity - 1)];
+}
+
+static inline size_t
+iproto_ring_unused(struct iproto_ring *ring)
+{
+	return ring->capacity - (ring->tail - ring->head);
+}
+
+/* Account the size bytes received to the iproto_ring_wpos(). */
+static inline void
+iproto_ring_produce(struct iproto_ring *ring, size_t size)
+{
+	ring->tail += size;
+}
+
+/*
+ * Make sure there's the free space for the size bytes and the frame being
+ * received fits. Grows the ring, so the data received and not parsed yet
+ * is moved.
+ */
+void
+iproto_ring_reserve(struct iproto_ring *ring, size_t size)
+{
+	size_t used = ring->tail - ring->head;
+	if (used + size <= ring->capacity && ring->frame_size < ring->capacity)
+		return;
+	size_t capacity = used + size > ring->frame_size ? used + size : ring->frame_size;
+	struct iproto_ring new_ring;
+	iproto_ring_create(&new_ring, capacity + 1);
+	memcpy(new_ring.data, iproto_ring_rpos(ring), used);
+	new_ring.tail = used;
+	new_ring.frame_size = ring->frame_size;
+	iproto_ring_destroy(ring);
+	*ring = new_ring;
+}
+
+/* The initial size of the receive rings, they grow to fit the frames. */
+#define BENCH_RECV_BUF_SIZE 65536
+
+/* A response frame parsed in the ring. */
+struct iproto_frame {
+	uint64_t sync;
+	/* 0 on success, 0x8000 | error code on failure. */
+	uint64_t status;
+	uint64_t schema_version;
+	/* The body, empty if the response has none. */
+	const char *body;
+	const char *body_end;
+};
+
+/* Validate the body of each frame with mp_check (-V). */
+static bool iproto_check_body = false;
+
+/*
+ * Parse the next frame if it's received completely: returns 1 and
+ * consumes the frame, the frame data is valid until the next receive into
+ * the ring. Returns 0 if more data is needed (the size of the frame is
+ * set to the ring->frame_size once known), -1 if the data is malformed.
+ */
+int
+iproto_ring_next_frame(struct iproto_ring *ring, struct iproto_frame *frame)
+{
+	const char *start = (const char *)iproto_ring_rpos(ring);
+	const char *end = start + (ring->tail - ring->head);
+	const char *pos = start;
+	if (pos == end)
+		return 0;
+	if (mp_typeof(*pos) != MP_UINT)
+		return -1;
+	if (mp_check_uint(pos, end) > 0)
+		return 0;
+	uint64_t size = mp_decode_uint(&pos);
+	ring->frame_size = pos - start + size;
+	if (end - pos < size)
+		return 0;
+	end = pos + size;
+	/* The header. */
+	const char *header = pos;
+	if (mp_typeof(*pos) != MP_MAP || mp_check(&header, end) != 0)
+		return -1;
+	memset(frame, 0, sizeof(*frame));
+	uint32_t header_size = mp_decode_map(&pos);
+	for (uint32_t i = 0; i < header_size; i++) {
+		if (mp_typeof(*pos) != MP_UINT)
+			return -1;
+		uint64_t key = mp_decode_uint(&pos);
+		uint64_t *value = NULL;
+		if (key == IPROTO_REQUEST_TYPE)
+			value = &frame->status;
+		else if (key == IPROTO_SYNC)
+			value = &frame->sync;
+		else if (key == IPROTO_SCHEMA_VERSION)
+			value = &frame->schema_version;
+		if (value == NULL) {
+			mp_next(&pos);
+			continue;
+		}
+		if (mp_typeof(*pos) != MP_UINT)
+			return -1;
+		*value = mp_decode_uint(&pos);
+	}
+	/* The body. */
+	frame->body = pos;
+	frame->body_end = end;
+	if (iproto_check_body && pos != end && (mp_check(&pos, end) != 0 || pos != end))
+		return -1;
+	ring->head += end - start;
+	ring->frame_size = 0;
+	return 1;
+}
+
+/* Fail if the response is an error, print its message if any. */
+void
+iproto_frame_check_status(const struct iproto_frame *frame)
+{
+	if (frame->status == 0)
+		return;
+	const char *pos = frame->body;
+	if (pos != frame->body_end && mp_typeof(*pos) == MP_MAP) {
+		uint32_t size = mp_decode_map(&pos);
+		for (uint32_t i = 0; i < size; i++) {
+			if (mp_typeof(*pos) == MP_UINT && mp_decode_uint(&pos) == IPROTO_ERROR_24 &&
+			    mp_typeof(*pos) == MP_STR) {
+				uint32_t len;
+				const char *message = mp_decode_str(&pos, &len);
+				ERROR_FATAL("The request failed: %.*s", (int)len, message);
+			}
+			mp_next(&pos);
+		}
+	}
+	ERROR_FATAL("The request failed: code 0x%lx", frame->status);
+}
+
+/* Receive the next response frame, it's valid until the next call. */
+void
+bench_recv_frame(int fd, struct iproto_ring *ring, struct iproto_frame *frame)
+{
+	for (;;) {
+		int rc = iproto_ring_next_frame(ring, frame);
+		if (rc > 0)
+			break;
+		if (rc < 0)
+			ERROR_FATAL("Malformed response.");
+		iproto_ring_reserve(ring, 1);
+		ssize_t received = recv(fd, iproto_ring_wpos(ring), iproto_ring_unused(ring), 0);
+		if (received == 0)
+			ERROR_FATAL("The connection is closed by the server.");
+		if (received < 0)
+			ERROR_SYS("Couldn't receive a response");
+		iproto_ring_produce(ring, received);
+	}
+	iproto_frame_check_status(frame);
+}
+
 uint64_t
-bench_raw_request(int fd, size_t req_size, const uint8_t *req, size_t res_size, const uint8_t *res)
+bench_raw_request(int fd, struct iproto_ring *ring, size_t req_size, const uint8_t *req,
+		  size_t res_size, const uint8_t *res)
 {
 	uint8_t *buf = res_size  == 0 ? NULL : calloc(1, res_size);
 	struct timespec t0 = bench_start();
@@ -168,26 +393,8 @@ bench_raw_request(int fd, size_t req_size, const uint8_t *req, size_t res_size,
 		}
 		free(buf);
 	} else {
-		size_t data_size = -1;
-		size_t data_size_size = -1;
-		uint8_t data_size_and_possibly_data[9];
-		read(fd, data_size_and_possibly_data, sizeof(data_size_and_possibly_data));
-		if (data_size_and_possibly_data[0] == 0xce) {
-			data_size = get_uint32(&data_size_and_possibly_data[1]);
-			data_size_size = 5;
-		} else if (data_size_and_possibly_data[0] == 0xcf) {
-			data_size = get_uint64(&data_size_and_possibly_data[1]);
-			data_size_size = 9;
-		} else {
-			ERROR_FATAL("Unexpected packet data_size encoding: %02hhx\n", data_size_and_possibly_data[0]);
-		}
-		size_t data_bytes_read = sizeof(data_size_and_possibly_data) - data_size_size;
-		size_t data_bytes_remained = data_size - data_bytes_read;
-		static uint8_t data[1024];
-		if (data_bytes_remained > sizeof(data))
-			ERROR_FATAL("Couldn't read the packet into the static buffer.\n");
-		if (read(fd, data, data_bytes_remained) != data_bytes_remained)
-			ERROR_FATAL("Read less than epected.\n");
+		struct iproto_frame frame;
+		bench_recv_frame(fd, ring, &frame);
 		result = bench_finish(t0);
 	}
 	return result;
@@ -307,47 +514,1176 @@ bench_create_ping(int sync)
 
 #undef BENCH_CREATE_WHATEVER
 
+/* Create a ping or a call of the function with the given name. */
+struct Data
+bench_create(const char *what, int sync)
+{
+	if (strcmp(what, "ping") == 0)
+		return bench_create_ping(sync);
+	return bench_create_call(sync, what);
+}
+
+/*
+ * Encode a ping or a call of the function with the given name prefixed
+ * by its size into the data, return the size. Only get the size if the
+ * data is NULL.
+ */
+size_t
+bench_encode(uint8_t *data, const char *what, int sync)
+{
+	bool is_ping = strcmp(what, "ping") == 0;
+	size_t packet_size = is_ping ? iproto_write_ping(NULL, sync) :
+				       iproto_write_call(NULL, sync, what);
+	if (data == NULL)
+		return mp_sizeof_uint(packet_size) + packet_size;
+	uint8_t *packet = (uint8_t *)mp_encode_uint((char *)data, packet_size);
+	if (is_ping)
+		iproto_write_ping(packet, sync);
+	else
+		iproto_write_call(packet, sync, what);
+	return packet - data + packet_size;
+}
+
+/*
+ * The latency histogram with 3 significant digits over 1 ns..10 s (HDR
+ * histogram layout): the values are split into the power of two buckets,
+ * each of them is split into the linear sub-buckets. The bucket 0 counts
+ * each value below BENCH_HIST_SUB_BUCKET_COUNT, the next ones only have
+ * the upper halves of the sub-buckets, each twice as wide as the previous
+ * bucket ones. The histograms are merged by summing the counts.
+ */
+#define BENCH_HIST_SUB_BUCKET_HALF_MAGNITUDE 10
+#define BENCH_HIST_SUB_BUCKET_HALF_COUNT (1 << BENCH_HIST_SUB_BUCKET_HALF_MAGNITUDE)
+#define BENCH_HIST_SUB_BUCKET_COUNT (2 * BENCH_HIST_SUB_BUCKET_HALF_COUNT)
+#define BENCH_HIST_VALUE_MAX 10000000000llu
+/* The sub-buckets of the last bucket reach 2^34 > BENCH_HIST_VALUE_MAX. */
+#define BENCH_HIST_BUCKET_COUNT 24
+#define BENCH_HIST_COUNTS_LEN ((BENCH_HIST_BUCKET_COUNT + 1) * BENCH_HIST_SUB_BUCKET_HALF_COUNT)
+
+struct bench_hist {
+	uint64_t count;
+	uint64_t min;
+	uint64_t max;
+	uint64_t sum;
+	uint64_t counts[BENCH_HIST_COUNTS_LEN];
+};
+
+int
+bench_hist_index(uint64_t value)
+{
+	if (value > BENCH_HIST_VALUE_MAX)
+		value = BENCH_HIST_VALUE_MAX;
+	int bucket = 64 - __builtin_clzll(value | (BENCH_HIST_SUB_BUCKET_COUNT - 1)) -
+		     (BENCH_HIST_SUB_BUCKET_HALF_MAGNITUDE + 1);
+	int sub_bucket = value >> bucket;
+	return ((bucket + 1) << BENCH_HIST_SUB_BUCKET_HALF_MAGNITUDE) +
+	       sub_bucket - BENCH_HIST_SUB_BUCKET_HALF_COUNT;
+}
+
+/* The highest value counted at the index. */
+uint64_t
+bench_hist_value(int index)
+{
+	int bucket = (index >> BENCH_HIST_SUB_BUCKET_HALF_MAGNITUDE) - 1;
+	uint64_t sub_bucket = (index & (BENCH_HIST_SUB_BUCKET_HALF_COUNT - 1)) +
+			      BENCH_HIST_SUB_BUCKET_HALF_COUNT;
+	if (bucket < 0) {
+		sub_bucket -= BENCH_HIST_SUB_BUCKET_HALF_COUNT;
+		bucket = 0;
+	}
+	return (sub_bucket << bucket) + (1llu << bucket) - 1;
+}
+
+void
+bench_hist_add(struct bench_hist *hist, uint64_t ns)
+{
+	if (hist->count == 0 || hist->min > ns)
+		hist->min = ns;
+	if (hist->max < ns)
+		hist->max = ns;
+	hist->sum += ns;
+	hist->count++;
+	hist->counts[bench_hist_index(ns)]++;
+}
+
+void
+bench_hist_merge(struct bench_hist *hist, const struct bench_hist *other)
+{
+	if (other->count == 0)
+		return;
+	if (hist->count == 0 || hist->min > other->min)
+		hist->min = other->min;
+	if (hist->max < other->max)
+		hist->max = other->max;
+	hist->sum += other->sum;
+	hist->count += other->count;
+	for (int i = 0; i < BENCH_HIST_COUNTS_LEN; i++)
+		hist->counts[i] += other->counts[i];
+}
+
+/*
+ * The value the percentile of the values are less than or equal to (with
+ * the histogram precision), the max is exact.
+ */
 uint64_t
-bench_exec_nocheck(int fd, struct Data data)
+bench_hist_percentile(const struct bench_hist *hist, double percentile)
 {
-	return bench_raw_request(fd, data.raw_req_size, data.raw_req, 0, NULL);
+	uint64_t rank = percentile / 100 * hist->count + 0.5;
+	if (rank == 0)
+		rank = 1;
+	uint64_t total = 0;
+	for (int i = 0; i < BENCH_HIST_COUNTS_LEN; i++) {
+		total += hist->counts[i];
+		if (total >= rank) {
+			uint64_t value = bench_hist_value(i);
+			return value < hist->max ? value : hist->max;
+		}
+	}
+	return hist->max;
 }
 
+/* The format of the bench reports. */
+enum bench_format {
+	/* The Markdown percentile table, like in the results.md. */
+	BENCH_FORMAT_TABLE,
+	/* The full distribution: the CSV of the histogram counts. */
+	BENCH_FORMAT_CSV,
+	/* The percentiles summary: a JSON object per line. */
+	BENCH_FORMAT_JSON,
+};
+
+static enum bench_format bench_format = BENCH_FORMAT_TABLE;
+
+static const double bench_percentiles[] = {50, 90, 99, 99.9, 99.99};
+static const char *bench_percentile_names[] = {"p50", "p90", "p99", "p99.9", "p99.99"};
+
+/* Report the latencies of the named run measured at the given RPS. */
 void
-bench(int fd, struct Data request, int count)
-{
-	uint64_t ns_first = bench_exec_nocheck(fd, request);
-	uint64_t ns_min = ns_first;
-	uint64_t ns_max = ns_first;
-	uint64_t ns_sum = 0;
-	for (int i = 1; i < count; i++) {
-		size_t ns = bench_exec_nocheck(fd, request);
-		if (ns_max < ns) {
-			ns_max = ns;
+bench_report(const char *name, uint64_t rps, const struct bench_hist *hist)
+{
+	uint64_t avg = hist->count == 0 ? 0 : hist->sum / hist->count;
+	switch (bench_format) {
+	case BENCH_FORMAT_TABLE:
+		printf("## %s\n\n", name);
+		printf("| Stat   | ns         |\n");
+		printf("| ------ | ---------- |\n");
+		printf("| RPS    | %-10lu |\n", rps);
+		printf("| Count  | %-10lu |\n", hist->count);
+		printf("| Min    | %-10lu |\n", hist->min);
+		printf("| Avg    | %-10lu |\n", avg);
+		for (int i = 0; i < lengthof(bench_percentiles); i++)
+			printf("| %-6s | %-10lu |\n", bench_percentile_names[i],
+			       bench_hist_percentile(hist, bench_percentiles[i]));
+		printf("| Max    | %-10lu |\n\n", hist->max);
+		break;
+	case BENCH_FORMAT_CSV: {
+		static bool header_printed = false;
+		if (!header_printed) {
+			printf("name,value,count,percentile\n");
+			header_printed = true;
+		}
+		uint64_t total = 0;
+		for (int i = 0; i < BENCH_HIST_COUNTS_LEN; i++) {
+			if (hist->counts[i] == 0)
+				continue;
+			total += hist->counts[i];
+			printf("\"%s\",%lu,%lu,%.6f\n", name, bench_hist_value(i),
+			       hist->counts[i], 100.0 * total / hist->count);
+		}
+		break;
+	}
+	case BENCH_FORMAT_JSON:
+		printf("{\"name\": \"%s\", \"rps\": %lu, \"count\": %lu, "
+		       "\"min\": %lu, \"avg\": %lu", name, rps, hist->count,
+		       hist->min, avg);
+		for (int i = 0; i < lengthof(bench_percentiles); i++)
+			printf(", \"%s\": %lu", bench_percentile_names[i],
+			       bench_hist_percentile(hist, bench_percentiles[i]));
+		printf(", \"max\": %lu}\n", hist->max);
+		break;
+	}
+	fflush(stdout);
+}
+
+uint64_t
+bench_exec_nocheck(int fd, struct iproto_ring *ring, struct Data data)
+{
+	return bench_raw_request(fd, ring, data.raw_req_size, data.raw_req, 0, NULL);
+}
+
+void
+bench(int fd, const char *what, int count)
+{
+	struct Data request = bench_create(what, 0);
+	struct bench_hist *hist = calloc(1, sizeof(*hist));
+	struct iproto_ring ring;
+	iproto_ring_create(&ring, BENCH_RECV_BUF_SIZE);
+	struct timespec t0 = bench_start();
+	uint64_t ns_first = bench_exec_nocheck(fd, &ring, request);
+	bench_hist_add(hist, ns_first);
+	for (int i = 1; i < count; i++)
+		bench_hist_add(hist, bench_exec_nocheck(fd, &ring, request));
+	uint64_t ns_total = bench_finish(t0);
+	if (bench_format == BENCH_FORMAT_TABLE)
+		printf("First: %lu\n\n", ns_first);
+	bench_report(what, count * 1000000000lu / ns_total, hist);
+	iproto_ring_destroy(&ring);
+	free(hist);
+	free(request.raw_req);
+}
+
+/*
+ * Keep depth requests in flight on the connection: the request i has the
+ * sync i and is sent again once its reply is received. The replies are
+ * matched by the sync, so the latency of a request is from its own send
+ * to its reply, whichever order the replies come in.
+ */
+void
+bench_pipelined(int fd, const char *what, int depth, int count)
+{
+	struct Data *requests = calloc(depth, sizeof(*requests));
+	struct timespec *sent_at = calloc(depth, sizeof(*sent_at));
+	bool *in_flight = calloc(depth, sizeof(*in_flight));
+	struct bench_hist *hist = calloc(1, sizeof(*hist));
+	struct iproto_ring ring;
+	iproto_ring_create(&ring, BENCH_RECV_BUF_SIZE);
+	for (int i = 0; i < depth; i++)
+		requests[i] = bench_create(what, i);
+	int sent = 0;
+	struct timespec t0 = bench_start();
+	for (int i = 0; i < depth && sent < count; i++, sent++) {
+		sent_at[i] = bench_start();
+		in_flight[i] = true;
+		write(fd, requests[i].raw_req, requests[i].raw_req_size);
+	}
+	for (int received = 0; received < count; received++) {
+		struct iproto_frame frame;
+		bench_recv_frame(fd, &ring, &frame);
+		uint64_t sync = frame.sync;
+		if (sync >= depth || !in_flight[sync])
+			ERROR_FATAL("Unexpected sync: %lu", sync);
+		bench_hist_add(hist, bench_finish(sent_at[sync]));
+		in_flight[sync] = false;
+		if (sent < count) {
+			sent_at[sync] = bench_start();
+			in_flight[sync] = true;
+			write(fd, requests[sync].raw_req, requests[sync].raw_req_size);
+			sent++;
 		}
-		if (ns_min > ns) {
-			ns_min = ns;
+	}
+	uint64_t ns_total = bench_finish(t0);
+	char name[256];
+	snprintf(name, sizeof(name), "%s, depth %d", what, depth);
+	bench_report(name, count * 1000000000lu / ns_total, hist);
+	iproto_ring_destroy(&ring);
+	free(hist);
+	for (int i = 0; i < depth; i++)
+		free(requests[i].raw_req);
+	free(requests);
+	free(sent_at);
+	free(in_flight);
+}
+
+uint64_t
+bench_now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000llu + t.tv_nsec;
+}
+
+/* Maximum count of requests in flight on an open-loop connection. */
+#define BENCH_CONN_IN_FLIGHT_MAX 65536
+
+/* How long to wait for the replies after the last request is sent. */
+#define BENCH_DRAIN_NS 1000000000llu
+
+/* A non-blocking connection of the open-loop bench. */
+struct bench_conn {
+	int fd;
+	/* The sync of the next request. */
+	int sync;
+	/* The intended send time of the sync s is at s % BENCH_CONN_IN_FLIGHT_MAX. */
+	uint64_t *intended_at;
+	/*
+	 * Set if the sync s is sent and not replied yet, at the same index.
+	 * The replies may come out of order: the server runs each request
+	 * in its own fiber.
+	 */
+	bool *is_in_flight;
+	int in_flight;
+	/* The requests not written yet. */
+	uint8_t *send_buf;
+	size_t send_size;
+	size_t send_capacity;
+	/* The replies received and not parsed yet. */
+	struct iproto_ring recv_ring;
+	/* Set if the socket is polled for EPOLLOUT: some requests are not written. */
+	bool polls_out;
+};
+
+void
+bench_conn_create(struct bench_conn *conn, const char *hostname, uint16_t port)
+{
+	memset(conn, 0, sizeof(*conn));
+	conn->fd = bench_connect(hostname, port);
+	int one = 1;
+	if (setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1)
+		ERROR_SYS("Couldn't set TCP_NODELAY");
+	if (fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK) == -1)
+		ERROR_SYS("Couldn't make the socket non-blocking");
+	conn->intended_at = calloc(BENCH_CONN_IN_FLIGHT_MAX, sizeof(*conn->intended_at));
+	conn->is_in_flight = calloc(BENCH_CONN_IN_FLIGHT_MAX, sizeof(*conn->is_in_flight));
+	conn->send_capacity = 4096;
+	conn->send_buf = malloc(conn->send_capacity);
+	iproto_ring_create(&conn->recv_ring, BENCH_RECV_BUF_SIZE);
+	if (conn->intended_at == NULL || conn->is_in_flight == NULL ||
+	    conn->send_buf == NULL)
+		ERROR_FATAL("Couldn't allocate a connection.");
+}
+
+/* Queue the request intended to be sent at the given time. */
+void
+bench_conn_push(struct bench_conn *conn, const char *what, uint64_t intended_at)
+{
+	if (conn->is_in_flight[conn->sync % BENCH_CONN_IN_FLIGHT_MAX])
+		ERROR_FATAL("Too many requests in flight, the server is overloaded.");
+	size_t size = bench_encode(NULL, what, conn->sync);
+	if (conn->send_size + size > conn->send_capacity) {
+		conn->send_capacity = (conn->send_size + size) * 2;
+		conn->send_buf = realloc(conn->send_buf, conn->send_capacity);
+		if (conn->send_buf == NULL)
+			ERROR_FATAL("Couldn't allocate the send buffer.");
+	}
+	conn->send_size += bench_encode(&conn->send_buf[conn->send_size], what, conn->sync);
+	conn->intended_at[conn->sync % BENCH_CONN_IN_FLIGHT_MAX] = intended_at;
+	conn->is_in_flight[conn->sync % BENCH_CONN_IN_FLIGHT_MAX] = true;
+	conn->in_flight++;
+	conn->sync++;
+}
+
+/* Write the queued requests, return false if some are left. */
+bool
+bench_conn_flush(struct bench_conn *conn)
+{
+	if (conn->send_size == 0)
+		return true;
+	ssize_t written = write(conn->fd, conn->send_buf, conn->send_size);
+	if (written < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return false;
+		ERROR_SYS("Couldn't write the requests");
+	}
+	memmove(conn->send_buf, &conn->send_buf[written], conn->send_size - written);
+	conn->send_size -= written;
+	return conn->send_size == 0;
+}
+
+/*
+ * Parse the replies received completely and account their latencies from
+ * the intended send times of their requests.
+ */
+void
+bench_conn_parse(struct bench_conn *conn, struct bench_hist *hist, uint64_t now)
+{
+	struct iproto_frame frame;
+	int rc;
+	while ((rc = iproto_ring_next_frame(&conn->recv_ring, &frame)) > 0) {
+		iproto_frame_check_status(&frame);
+		uint64_t sync = frame.sync;
+		if (sync >= conn->sync || conn->sync - sync > BENCH_CONN_IN_FLIGHT_MAX ||
+		    !conn->is_in_flight[sync % BENCH_CONN_IN_FLIGHT_MAX])
+			ERROR_FATAL("Unexpected sync: %lu", sync);
+		bench_hist_add(hist, now - conn->intended_at[sync % BENCH_CONN_IN_FLIGHT_MAX]);
+		conn->is_in_flight[sync % BENCH_CONN_IN_FLIGHT_MAX] = false;
+		conn->in_flight--;
+	}
+	if (rc < 0)
+		ERROR_FATAL("Malformed response.");
+}
+
+/* Read the replies available. */
+void
+bench_conn_recv(struct bench_conn *conn, struct bench_hist *hist)
+{
+	struct iproto_ring *ring = &conn->recv_ring;
+	for (;;) {
+		iproto_ring_reserve(ring, 1);
+		ssize_t received = recv(conn->fd, iproto_ring_wpos(ring),
+					iproto_ring_unused(ring), 0);
+		if (received == 0)
+			ERROR_FATAL("The connection is closed by the server.");
+		if (received < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			ERROR_SYS("Couldn't receive the replies");
 		}
-		ns_sum += ns;
+		iproto_ring_produce(ring, received);
+		bench_conn_parse(conn, hist, bench_now());
 	}
-	uint64_t ns_avg = ns_sum / count;
-	printf("First: %lu\n", ns_first);
-	printf("Max: %lu\n", ns_max);
-	printf("Avg: %lu\n", ns_avg);
-	printf("Min: %lu\n", ns_min);
+}
+
+/* The I/O backend of the open-loop bench. */
+enum bench_backend {
+	/* Non-blocking sockets, epoll_wait and a write/recv per socket. */
+	BENCH_BACKEND_EPOLL,
+	/* The writes and receives are submitted and reaped by io_uring. */
+	BENCH_BACKEND_IO_URING,
+};
+
+static const char *bench_backend_names[] = {"epoll", "io_uring"};
+
+/* A thread of the open-loop bench driving its own connections. */
+struct bench_worker {
+	pthread_t thread;
+	const char *what;
+	struct bench_conn *conns;
+	int conn_count;
+	/* The requests are sent each interval_ns from start_ns until end_ns. */
+	uint64_t interval_ns;
+	uint64_t start_ns;
+	uint64_t end_ns;
+	/* The intended send time of the next request and its connection. */
+	uint64_t next;
+	int conn_next;
+	struct bench_hist hist;
+	/* The requests left without a reply. */
+	uint64_t lost;
+};
+
+/*
+ * Queue the requests due, the late ones too: their latency includes the
+ * time they were waiting to be sent.
+ */
+void
+bench_worker_push_due(struct bench_worker *worker, uint64_t now)
+{
+	for (; worker->next <= now && worker->next < worker->end_ns;
+	     worker->next += worker->interval_ns) {
+		bench_conn_push(&worker->conns[worker->conn_next], worker->what, worker->next);
+		worker->conn_next = (worker->conn_next + 1) % worker->conn_count;
+	}
+}
+
+/*
+ * Check if all the requests are sent and replied, or the replies are not
+ * waited for anymore (the lost ones are counted then).
+ */
+bool
+bench_worker_is_done(struct bench_worker *worker, uint64_t now)
+{
+	uint64_t in_flight = 0;
+	for (int i = 0; i < worker->conn_count; i++)
+		in_flight += worker->conns[i].in_flight;
+	if (worker->next >= worker->end_ns && in_flight == 0)
+		return true;
+	if (now > worker->end_ns + BENCH_DRAIN_NS) {
+		worker->lost = in_flight;
+		return true;
+	}
+	return false;
+}
+
+/* How long to wait for the replies: until the next request is due. */
+uint64_t
+bench_worker_timeout(struct bench_worker *worker, uint64_t now)
+{
+	if (worker->next >= worker->end_ns)
+		return 1000000;
+	return worker->next > now ? worker->next - now : 0;
+}
+
+/* Poll the socket for EPOLLOUT until the requests queued are written. */
+void
+bench_epoll_poll_out(int epfd, struct bench_conn *conn, bool flushed)
+{
+	if (conn->polls_out == !flushed)
+		return;
+	struct epoll_event event = {
+		.events = flushed ? EPOLLIN : EPOLLIN | EPOLLOUT,
+		.data.ptr = conn,
+	};
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &event) == -1)
+		ERROR_SYS("Couldn't modify a socket in epoll");
+	conn->polls_out = !flushed;
+}
+
+void *
+bench_epoll_worker_f(void *arg)
+{
+	struct bench_worker *worker = arg;
+	int epfd = epoll_create1(0);
+	if (epfd == -1)
+		ERROR_SYS("Couldn't create an epoll instance");
+	for (int i = 0; i < worker->conn_count; i++) {
+		struct epoll_event event = {
+			.events = EPOLLIN,
+			.data.ptr = &worker->conns[i],
+		};
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, worker->conns[i].fd, &event) == -1)
+			ERROR_SYS("Couldn't add a socket to epoll");
+	}
+	for (;;) {
+		uint64_t now = bench_now();
+		bench_worker_push_due(worker, now);
+		for (int i = 0; i < worker->conn_count; i++) {
+			struct bench_conn *conn = &worker->conns[i];
+			bench_epoll_poll_out(epfd, conn, bench_conn_flush(conn));
+		}
+		if (bench_worker_is_done(worker, now))
+			break;
+		/* The sockets writable again are flushed on the next iteration. */
+		uint64_t timeout = bench_worker_timeout(worker, now);
+		struct timespec ts = {
+			.tv_sec = timeout / 1000000000,
+			.tv_nsec = timeout % 1000000000,
+		};
+		struct epoll_event events[64];
+		int count = epoll_pwait2(epfd, events, lengthof(events), &ts, NULL);
+		if (count == -1 && errno != EINTR)
+			ERROR_SYS("Couldn't wait for the replies");
+		for (int i = 0; i < count; i++) {
+			if ((events[i].events & EPOLLIN) != 0)
+				bench_conn_recv(events[i].data.ptr, &worker->hist);
+		}
+	}
+	close(epfd);
+	return NULL;
+}
+
+/* An io_uring over the raw system calls, see io_uring(7). */
+struct bench_uring {
+	int fd;
+	uint32_t features;
+	void *sq_ptr;
+	size_t sq_size;
+	void *cq_ptr;
+	size_t cq_size;
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t *sq_array;
+	uint32_t sq_mask;
+	uint32_t sq_entries;
+	struct io_uring_sqe *sqes;
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t cq_mask;
+	struct io_uring_cqe *cqes;
+	/* The SQEs queued, but not submitted yet. */
+	uint32_t to_submit;
+};
+
+void
+bench_uring_create(struct bench_uring *ring, uint32_t entries)
+{
+	struct io_uring_params params = {};
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring->fd < 0)
+		ERROR_SYS("Couldn't create an io_uring");
+	ring->features = params.features;
+	ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		if (ring->sq_size < ring->cq_size)
+			ring->sq_size = ring->cq_size;
+		ring->cq_size = ring->sq_size;
+	}
+	ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED)
+		ERROR_SYS("Couldn't map the submission queue");
+	ring->cq_ptr = ring->sq_ptr;
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0) {
+		ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED)
+			ERROR_SYS("Couldn't map the completion queue");
+	}
+	ring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+			  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+			  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		ERROR_SYS("Couldn't map the submission queue entries");
+	uint8_t *sq = ring->sq_ptr;
+	uint8_t *cq = ring->cq_ptr;
+	ring->sq_head = (uint32_t *)(sq + params.sq_off.head);
+	ring->sq_tail = (uint32_t *)(sq + params.sq_off.tail);
+	ring->sq_array = (uint32_t *)(sq + params.sq_off.array);
+	ring->sq_mask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+	ring->sq_entries = params.sq_entries;
+	ring->cq_head = (uint32_t *)(cq + params.cq_off.head);
+	ring->cq_tail = (uint32_t *)(cq + params.cq_off.tail);
+	ring->cq_mask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+}
+
+void
+bench_uring_destroy(struct bench_uring *ring)
+{
+	munmap(ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe));
+	if (ring->cq_ptr != ring->sq_ptr)
+		munmap(ring->cq_ptr, ring->cq_size);
+	munmap(ring->sq_ptr, ring->sq_size);
+	close(ring->fd);
+}
+
+/*
+ * The user data of the timeout requests bench_uring_enter() waits by if the
+ * kernel doesn't support IORING_ENTER_EXT_ARG, their completions are ignored.
+ */
+#define BENCH_URING_TIMEOUT_DATA UINT64_MAX
+
+void
+bench_uring_enter(struct bench_uring *ring, uint32_t min_complete, uint64_t timeout_ns);
+
+/* Get a zeroed SQE to fill, it's submitted by the next enter. */
+struct io_uring_sqe *
+bench_uring_sqe(struct bench_uring *ring)
+{
+	uint32_t tail = *ring->sq_tail;
+	if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries) {
+		bench_uring_enter(ring, 0, 0);
+		if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == ring->sq_entries)
+			ERROR_FATAL("The io_uring submission queue is full.");
+	}
+	uint32_t index = tail & ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->to_submit++;
+	return sqe;
+}
+
+/*
+ * Submit the SQEs queued and wait for min_complete completions for up to
+ * timeout_ns. The timeout is passed by IORING_ENTER_EXT_ARG if the kernel
+ * supports it, otherwise a timeout request is queued to complete by then or
+ * on the next completion, so the ones of the previous waits don't pile up.
+ */
+void
+bench_uring_enter(struct bench_uring *ring, uint32_t min_complete, uint64_t timeout_ns)
+{
+	uint32_t flags = 0;
+	struct __kernel_timespec ts = {
+		.tv_sec = timeout_ns / 1000000000,
+		.tv_nsec = timeout_ns % 1000000000,
+	};
+	struct io_uring_getevents_arg arg = {
+		.ts = (uint64_t)(uintptr_t)&ts,
+	};
+	bool ext_arg = (ring->features & IORING_FEAT_EXT_ARG) != 0;
+	if (min_complete != 0 && ext_arg) {
+		flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+	} else if (min_complete != 0) {
+		/* The timespec is copied on the submission below. */
+		struct io_uring_sqe *sqe = bench_uring_sqe(ring);
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->addr = (uint64_t)(uintptr_t)&ts;
+		sqe->len = 1;
+		sqe->off = 1;
+		sqe->user_data = BENCH_URING_TIMEOUT_DATA;
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+	int rc = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, min_complete,
+			 flags, ext_arg && flags != 0 ? &arg : NULL,
+			 ext_arg && flags != 0 ? sizeof(arg) : 0);
+	if (rc < 0 && errno != ETIME && errno != EINTR)
+		ERROR_SYS("Couldn't enter the io_uring");
+	if (rc > 0)
+		ring->to_submit -= rc;
+}
+
+/* The count of the buffers provided for the multishot receives. */
+#define BENCH_URING_RECV_BUF_COUNT 64
+#define BENCH_URING_RECV_BUF_SIZE 16384
+
+/* The registered buffer the requests of a connection are written from. */
+#define BENCH_URING_WRITE_BUF_SIZE 65536
+
+/* The operation of a completion, the rest of the user_data is the connection. */
+enum {
+	BENCH_URING_OP_WRITE,
+	BENCH_URING_OP_RECV,
+	BENCH_URING_OP_CANCEL,
+	BENCH_URING_OP_BITS = 2,
+};
+
+/* The io_uring state of a connection. */
+struct bench_uring_conn {
+	uint8_t *write_buf;
+	size_t write_size;
+	size_t write_done;
+	bool write_in_flight;
+	bool recv_armed;
+};
+
+/* The io_uring state of a worker. */
+struct bench_uring_worker {
+	struct bench_uring ring;
+	struct bench_uring_conn *conns;
+	/* Set if the write buffers are registered (IORING_OP_WRITE_FIXED). */
+	bool write_fixed;
+	/* Set if the multishot receives to the provided buffers are used. */
+	bool recv_multishot;
+	struct io_uring_buf_ring *buf_ring;
+	size_t buf_ring_size;
+	uint16_t buf_ring_tail;
+	uint8_t *recv_bufs;
+};
+
+/* Give the provided buffer back to the kernel. */
+void
+bench_uring_buf_recycle(struct bench_uring_worker *uw, uint16_t bid)
+{
+	struct io_uring_buf *buf =
+		&uw->buf_ring->bufs[uw->buf_ring_tail & (BENCH_URING_RECV_BUF_COUNT - 1)];
+	buf->addr = (uint64_t)(uintptr_t)&uw->recv_bufs[bid * BENCH_URING_RECV_BUF_SIZE];
+	buf->len = BENCH_URING_RECV_BUF_SIZE;
+	buf->bid = bid;
+	uw->buf_ring_tail++;
+	__atomic_store_n(&uw->buf_ring->tail, uw->buf_ring_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Set the ring up: register the write buffers and provide the receive
+ * buffers where the kernel supports it, use the plain writes and the
+ * single receives otherwise.
+ */
+void
+bench_uring_worker_create(struct bench_uring_worker *uw, struct bench_worker *worker)
+{
+	int conn_count = worker->conn_count;
+	memset(uw, 0, sizeof(*uw));
+	bench_uring_create(&uw->ring, 4 * conn_count < 64 ? 64 : 4 * conn_count);
+	uw->conns = calloc(conn_count, sizeof(*uw->conns));
+	struct iovec *iovs = calloc(conn_count, sizeof(*iovs));
+	if (uw->conns == NULL || iovs == NULL)
+		ERROR_FATAL("Couldn't allocate the io_uring connections.");
+	for (int i = 0; i < conn_count; i++) {
+		uw->conns[i].write_buf = malloc(BENCH_URING_WRITE_BUF_SIZE);
+		if (uw->conns[i].write_buf == NULL)
+			ERROR_FATAL("Couldn't allocate a write buffer.");
+		iovs[i].iov_base = uw->conns[i].write_buf;
+		iovs[i].iov_len = BENCH_URING_WRITE_BUF_SIZE;
+	}
+	uw->write_fixed = syscall(__NR_io_uring_register, uw->ring.fd,
+				  IORING_REGISTER_BUFFERS, iovs, conn_count) == 0;
+	free(iovs);
+
+	uw->buf_ring_size = BENCH_URING_RECV_BUF_COUNT * sizeof(struct io_uring_buf);
+	uw->buf_ring = mmap(NULL, uw->buf_ring_size, PROT_READ | PROT_WRITE,
+			    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	uw->recv_bufs = malloc(BENCH_URING_RECV_BUF_COUNT * BENCH_URING_RECV_BUF_SIZE);
+	if (uw->buf_ring == MAP_FAILED || uw->recv_bufs == NULL)
+		ERROR_FATAL("Couldn't allocate the receive buffers.");
+	struct io_uring_buf_reg reg = {
+		.ring_addr = (uint64_t)(uintptr_t)uw->buf_ring,
+		.ring_entries = BENCH_URING_RECV_BUF_COUNT,
+		.bgid = 0,
+	};
+	uw->recv_multishot = syscall(__NR_io_uring_register, uw->ring.fd,
+				     IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+	if (uw->recv_multishot) {
+		for (int i = 0; i < BENCH_URING_RECV_BUF_COUNT; i++)
+			bench_uring_buf_recycle(uw, i);
+	}
+}
+
+void
+bench_uring_worker_destroy(struct bench_uring_worker *uw, struct bench_worker *worker)
+{
+	bench_uring_destroy(&uw->ring);
+	for (int i = 0; i < worker->conn_count; i++)
+		free(uw->conns[i].write_buf);
+	free(uw->conns);
+	munmap(uw->buf_ring, uw->buf_ring_size);
+	free(uw->recv_bufs);
+}
+
+/* Write the next part of the requests of the connection. */
+void
+bench_uring_write(struct bench_uring_worker *uw, struct bench_worker *worker, int i)
+{
+	struct bench_uring_conn *uc = &uw->conns[i];
+	struct bench_conn *conn = &worker->conns[i];
+	if (uc->write_done == uc->write_size) {
+		/* Move the requests queued to the write buffer. */
+		size_t size = conn->send_size < BENCH_URING_WRITE_BUF_SIZE ?
+			      conn->send_size : BENCH_URING_WRITE_BUF_SIZE;
+		memcpy(uc->write_buf, conn->send_buf, size);
+		memmove(conn->send_buf, &conn->send_buf[size], conn->send_size - size);
+		conn->send_size -= size;
+		uc->write_size = size;
+		uc->write_done = 0;
+	}
+	struct io_uring_sqe *sqe = bench_uring_sqe(&uw->ring);
+	sqe->opcode = uw->write_fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	sqe->fd = conn->fd;
+	sqe->addr = (uint64_t)(uintptr_t)&uc->write_buf[uc->write_done];
+	sqe->len = uc->write_size - uc->write_done;
+	sqe->buf_index = i;
+	sqe->user_data = (uint64_t)i << BENCH_URING_OP_BITS | BENCH_URING_OP_WRITE;
+	uc->write_in_flight = true;
+}
+
+/* Arm the receive of the connection: multishot if supported. */
+void
+bench_uring_recv(struct bench_uring_worker *uw, struct bench_worker *worker, int i)
+{
+	struct bench_conn *conn = &worker->conns[i];
+	struct io_uring_sqe *sqe = bench_uring_sqe(&uw->ring);
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = conn->fd;
+	if (uw->recv_multishot) {
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = 0;
+		sqe->ioprio = IORING_RECV_MULTISHOT;
+	} else {
+		iproto_ring_reserve(&conn->recv_ring, 1);
+		sqe->addr = (uint64_t)(uintptr_t)iproto_ring_wpos(&conn->recv_ring);
+		sqe->len = iproto_ring_unused(&conn->recv_ring);
+	}
+	sqe->user_data = (uint64_t)i << BENCH_URING_OP_BITS | BENCH_URING_OP_RECV;
+	uw->conns[i].recv_armed = true;
+}
+
+void
+bench_uring_complete(struct bench_uring_worker *uw, struct bench_worker *worker,
+		     struct io_uring_cqe *cqe, uint64_t now)
+{
+	if (cqe->user_data == BENCH_URING_TIMEOUT_DATA)
+		return;
+	int op = cqe->user_data & ((1 << BENCH_URING_OP_BITS) - 1);
+	int i = cqe->user_data >> BENCH_URING_OP_BITS;
+	struct bench_uring_conn *uc = &uw->conns[i];
+	struct bench_conn *conn = &worker->conns[i];
+	if (op == BENCH_URING_OP_CANCEL)
+		return;
+	if (op == BENCH_URING_OP_WRITE) {
+		if (cqe->res < 0) {
+			errno = -cqe->res;
+			ERROR_SYS("Couldn't write the requests");
+		}
+		uc->write_done += cqe->res;
+		uc->write_in_flight = false;
+		return;
+	}
+	if ((cqe->flags & IORING_CQE_F_MORE) == 0)
+		uc->recv_armed = false;
+	if (cqe->res == -ENOBUFS || cqe->res == -ECANCELED)
+		return;
+	if (cqe->res == -EINVAL && uw->recv_multishot) {
+		/* The multishot receive is not supported. */
+		uw->recv_multishot = false;
+		return;
+	}
+	if (cqe->res < 0) {
+		errno = -cqe->res;
+		ERROR_SYS("Couldn't receive the replies");
+	}
+	if (cqe->res == 0)
+		ERROR_FATAL("The connection is closed by the server.");
+	if (uw->recv_multishot) {
+		uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		iproto_ring_reserve(&conn->recv_ring, cqe->res);
+		memcpy(iproto_ring_wpos(&conn->recv_ring),
+		       &uw->recv_bufs[bid * BENCH_URING_RECV_BUF_SIZE], cqe->res);
+		bench_uring_buf_recycle(uw, bid);
+	}
+	iproto_ring_produce(&conn->recv_ring, cqe->res);
+	bench_conn_parse(conn, &worker->hist, now);
+}
+
+/* Reap the completions available. */
+void
+bench_uring_reap(struct bench_uring_worker *uw, struct bench_worker *worker)
+{
+	struct bench_uring *ring = &uw->ring;
+	uint32_t head = *ring->cq_head;
+	uint32_t tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+	if (head == tail)
+		return;
+	uint64_t now = bench_now();
+	for (; head != tail; head++)
+		bench_uring_complete(uw, worker, &ring->cqes[head & ring->cq_mask], now);
+	__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+void *
+bench_uring_worker_f(void *arg)
+{
+	struct bench_worker *worker = arg;
+	struct bench_uring_worker uw;
+	bench_uring_worker_create(&uw, worker);
+	/* The non-blocking sockets would fail the operations with EAGAIN. */
+	for (int i = 0; i < worker->conn_count; i++) {
+		int fd = worker->conns[i].fd;
+		if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) == -1)
+			ERROR_SYS("Couldn't make the socket blocking");
+	}
+	for (;;) {
+		uint64_t now = bench_now();
+		bench_worker_push_due(worker, now);
+		for (int i = 0; i < worker->conn_count; i++) {
+			struct bench_uring_conn *uc = &uw.conns[i];
+			if (!uc->write_in_flight && (uc->write_done < uc->write_size ||
+						     worker->conns[i].send_size != 0))
+				bench_uring_write(&uw, worker, i);
+			if (!uc->recv_armed)
+				bench_uring_recv(&uw, worker, i);
+		}
+		if (bench_worker_is_done(worker, now))
+			break;
+		/* Submit and wait for the replies until the next request is due. */
+		bench_uring_enter(&uw.ring, 1, bench_worker_timeout(worker, now));
+		bench_uring_reap(&uw, worker);
+	}
+	/* Cancel the receives, they must not outlive the worker. */
+	for (int i = 0; i < worker->conn_count; i++) {
+		if (!uw.conns[i].recv_armed)
+			continue;
+		struct io_uring_sqe *sqe = bench_uring_sqe(&uw.ring);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = (uint64_t)i << BENCH_URING_OP_BITS | BENCH_URING_OP_RECV;
+		sqe->user_data = (uint64_t)i << BENCH_URING_OP_BITS | BENCH_URING_OP_CANCEL;
+	}
+	for (int i = 0; i < worker->conn_count; i++) {
+		while (uw.conns[i].recv_armed || uw.conns[i].write_in_flight) {
+			bench_uring_enter(&uw.ring, 1, BENCH_DRAIN_NS);
+			bench_uring_reap(&uw, worker);
+		}
+	}
+	for (int i = 0; i < worker->conn_count; i++) {
+		int fd = worker->conns[i].fd;
+		if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1)
+			ERROR_SYS("Couldn't make the socket non-blocking");
+	}
+	bench_uring_worker_destroy(&uw, worker);
+	return NULL;
+}
+
+/*
+ * Send the requests at the fixed rate over the connections of the
+ * threads for the duration, regardless of the replies (open loop), and
+ * report the latencies measured from the intended send times. Returns
+ * the count of the replies.
+ */
+uint64_t
+bench_open_loop(struct bench_conn *conns, int thread_count, int conn_count,
+		const char *what, uint64_t rps, uint64_t duration_ns,
+		enum bench_backend backend)
+{
+	struct bench_worker *workers = calloc(thread_count, sizeof(*workers));
+	uint64_t start_ns = bench_now() + 10000000;
+	for (int i = 0; i < thread_count; i++) {
+		struct bench_worker *worker = &workers[i];
+		worker->what = what;
+		worker->conns = &conns[i * conn_count];
+		worker->conn_count = conn_count;
+		worker->interval_ns = 1000000000llu * thread_count / rps;
+		/* Spread the schedules of the threads over the interval. */
+		worker->start_ns = start_ns + worker->interval_ns * i / thread_count;
+		worker->end_ns = start_ns + duration_ns;
+		worker->next = worker->start_ns;
+		void *(*worker_f)(void *) = backend == BENCH_BACKEND_IO_URING ?
+					    bench_uring_worker_f : bench_epoll_worker_f;
+		if (pthread_create(&worker->thread, NULL, worker_f, worker) != 0)
+			ERROR_FATAL("Couldn't create a thread.");
+	}
+	struct bench_hist *hist = calloc(1, sizeof(*hist));
+	uint64_t lost = 0;
+	for (int i = 0; i < thread_count; i++) {
+		pthread_join(workers[i].thread, NULL);
+		bench_hist_merge(hist, &workers[i].hist);
+		lost += workers[i].lost;
+	}
+	char name[256];
+	snprintf(name, sizeof(name), "%s, target RPS %lu, %s", what, rps,
+		 bench_backend_names[backend]);
+	bench_report(name, hist->count * 1000000000lu / duration_ns, hist);
+	uint64_t count = hist->count;
+	free(hist);
+	free(workers);
+	if (lost != 0)
+		ERROR_FATAL("%lu replies are lost, the connections are unusable.", lost);
+	return count;
+}
+
+/* The CPU time used by the process (all the threads). */
+uint64_t
+bench_cpu_ns()
+{
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		ERROR_SYS("Couldn't get the resource usage");
+	return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000lu +
+	       (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000lu;
+}
+
+/*
+ * Measure the client CPU time per request of each backend: the blocking
+ * one request at a time bench and the open-loop ones at the given rate.
+ */
+void
+bench_calibrate(const char *what, int count, struct bench_conn *conns, int thread_count,
+		int conn_count, uint64_t rps, uint64_t duration_ns)
+{
+	uint64_t results[3][2];
+	int fd = bench_connect("localhost", 3301);
+	uint64_t cpu = bench_cpu_ns();
+	uint64_t t0 = bench_now();
+	bench(fd, what, count);
+	results[0][0] = count * 1000000000lu / (bench_now() - t0);
+	results[0][1] = (bench_cpu_ns() - cpu) / count;
+	close(fd);
+	for (int backend = 0; backend < lengthof(bench_backend_names); backend++) {
+		cpu = bench_cpu_ns();
+		uint64_t replies = bench_open_loop(conns, thread_count, conn_count, what,
+						   rps, duration_ns, backend);
+		results[backend + 1][0] = replies * 1000000000lu / duration_ns;
+		results[backend + 1][1] = replies == 0 ? 0 : (bench_cpu_ns() - cpu) / replies;
+	}
+	printf("## Calibration: %s\n\n", what);
+	printf("| Backend  | RPS        | CPU ns/request |\n");
+	printf("| -------- | ---------- | -------------- |\n");
+	printf("| %-8s | %-10lu | %-14lu |\n", "blocking", results[0][0], results[0][1]);
+	for (int backend = 0; backend < lengthof(bench_backend_names); backend++)
+		printf("| %-8s | %-10lu | %-14lu |\n", bench_backend_names[backend],
+		       results[backend + 1][0], results[backend + 1][1]);
+	printf("\n");
+}
+
+void
+usage(const char *name)
+{
+	printf("Usage: %s [-r request] [-n count] [-d depth]\n", name);
+	printf("       %s [-r request] -R rps[:rps_max:step] [-t threads] [-c connections] [-s seconds]\n"
+	       "          [-b backend]\n", name);
+	printf("       %s [-r request] [-n count] -C [-R rps] [-t threads] [-c connections] [-s seconds]\n", name);
+	printf("       add -f format to choose the report format\n");
+	printf("  -r  ping (default) or the name of a function to call\n");
+	printf("  -n  count of requests (per depth), 1000000 by default\n");
+	printf("  -d  pipeline the requests: keep 1, 2, 4... up to depth\n");
+	printf("      requests in flight, one at a time by default\n");
+	printf("  -R  send the requests at the fixed rate (open loop), from\n");
+	printf("      rps up to rps_max by step if given\n");
+	printf("  -t  open loop threads, 1 by default\n");
+	printf("  -c  open loop connections per thread, 1 by default\n");
+	printf("  -s  open loop seconds per rate, 5 by default\n");
+	printf("  -b  open loop backend: epoll (default) or io_uring\n");
+	printf("  -V  validate the response bodies with mp_check\n");
+	printf("  -C  calibrate: the client CPU per request of the blocking\n");
+	printf("      (-n requests) and each open loop backend (at -R rps,\n");
+	printf("      10000 by default)\n");
+	printf("  -f  table (default, Markdown), csv (full distribution)\n");
+	printf("      or json (percentiles) report format\n");
+	exit(1);
 }
 
 int
 main(int argc, char **argv)
 {
-	int fd = bench_connect("localhost", 3301);
+	const char *what = "ping";
+	int count = 1000000;
+	int depth_max = 0;
+	uint64_t rps = 0;
+	uint64_t rps_max = 0;
+	uint64_t rps_step = 1;
+	int thread_count = 1;
+	int conn_count = 1;
+	int seconds = 5;
+	enum bench_backend backend = BENCH_BACKEND_EPOLL;
+	bool calibrate = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "r:n:d:R:t:c:s:f:b:CV")) != -1) {
+		switch (opt) {
+		case 'r':
+			what = optarg;
+			break;
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 'd':
+			depth_max = atoi(optarg);
+			break;
+		case 'R':
+			if (sscanf(optarg, "%lu:%lu:%lu", &rps, &rps_max, &rps_step) == 1)
+				rps_max = rps;
+			break;
+		case 't':
+			thread_count = atoi(optarg);
+			break;
+		case 'c':
+			conn_count = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'f':
+			if (strcmp(optarg, "table") == 0)
+				bench_format = BENCH_FORMAT_TABLE;
+			else if (strcmp(optarg, "csv") == 0)
+				bench_format = BENCH_FORMAT_CSV;
+			else if (strcmp(optarg, "json") == 0)
+				bench_format = BENCH_FORMAT_JSON;
+			else
+				usage(argv[0]);
+			break;
+		case 'b':
+			if (strcmp(optarg, "epoll") == 0)
+				backend = BENCH_BACKEND_EPOLL;
+			else if (strcmp(optarg, "io_uring") == 0)
+				backend = BENCH_BACKEND_IO_URING;
+			else
+				usage(argv[0]);
+			break;
+		case 'C':
+			calibrate = true;
+			break;
+		case 'V':
+			iproto_check_body = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (count <= 0 || depth_max < 0 || rps_max < rps || rps_step == 0 ||
+	    thread_count <= 0 || conn_count <= 0 || seconds <= 0)
+		usage(argv[0]);
+	/* The request interval of each thread must be 1 ns at least. */
+	if (rps_max > 1000000000llu * thread_count)
+		ERROR_FATAL("The RPS can't exceed %llu with %d threads.",
+			    1000000000llu * thread_count, thread_count);
+
+	if (rps != 0 || calibrate) {
+		int total = thread_count * conn_count;
+		struct bench_conn *conns = calloc(total, sizeof(*conns));
+		for (int i = 0; i < total; i++)
+			bench_conn_create(&conns[i], "localhost", 3301);
+		if (calibrate) {
+			bench_calibrate(what, count, conns, thread_count, conn_count,
+					rps != 0 ? rps : 10000, seconds * 1000000000llu);
+			return 0;
+		}
+		for (; rps <= rps_max; rps += rps_step)
+			bench_open_loop(conns, thread_count, conn_count, what, rps,
+					seconds * 1000000000llu, backend);
+		return 0;
+	}
 
-	struct Data ping = bench_create_ping(0);
-	struct Data call_lua = bench_create_call(0, "lua_func");
-	struct Data call_c = bench_create_call(0, "counter_2");
+	int fd = bench_connect("localhost", 3301);
 
-	//bench_exec_nocheck(fd, ping);
-	bench(fd, ping, 1000000);
+	if (depth_max == 0) {
+		bench(fd, what, count);
+		return 0;
+	}
+	for (int depth = 1;; depth = depth * 2 < depth_max ? depth * 2 : depth_max) {
+		bench_pipelined(fd, what, depth, count);
+		if (depth == depth_max)
+			break;
+	}
 
 	return 0;
 }
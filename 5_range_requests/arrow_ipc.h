@@ -0,0 +1,532 @@
+#pragma once
+
+/*
+ * Minimal Arrow IPC stream writer. Writes the schema, the record batch and
+ * the end of stream messages of flat (struct of columns) Arrow arrays with
+ * fixed-width numeric, boolean, utf8 and binary columns. The flatbuffers
+ * metadata is written front to back by hand, see Message.fbs and Schema.fbs
+ * of the Apache Arrow format: the objects referenced by an offset are written
+ * after the referencing table and the offset is patched then.
+ *
+ * The messages don't depend on their position in the output buffer. The
+ * host is assumed to be little-endian. The functions return -1 if out of
+ * memory or if the array is not supported (see arrow_ipc_format_is_supported,
+ * the arrays and the columns must have zero offsets).
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arrow/abi.h"
+
+/* Growable byte buffer. */
+struct arrow_ipc_buf {
+	char *data;
+	size_t size;
+	size_t capacity;
+};
+
+/* Append size zero bytes, returns their position or -1 if out of memory. */
+static inline int64_t
+arrow_ipc_buf_grow(struct arrow_ipc_buf *buf, size_t size)
+{
+	if (buf->size + size > buf->capacity) {
+		size_t capacity = buf->capacity * 2;
+		if (capacity < buf->size + size)
+			capacity = buf->size + size;
+		char *data = (char *)realloc(buf->data, capacity);
+		if (data == NULL)
+			return -1;
+		buf->data = data;
+		buf->capacity = capacity;
+	}
+	memset(buf->data + buf->size, 0, size);
+	buf->size += size;
+	return buf->size - size;
+}
+
+static inline int
+arrow_ipc_buf_append(struct arrow_ipc_buf *buf, const void *src, size_t size)
+{
+	int64_t pos = arrow_ipc_buf_grow(buf, size);
+	if (pos < 0)
+		return -1;
+	if (size != 0)
+		memcpy(buf->data + pos, src, size);
+	return 0;
+}
+
+/* Pad the buffer with zeros so (size + extra) is a multiple of align. */
+static inline int
+arrow_ipc_buf_pad(struct arrow_ipc_buf *buf, size_t align, size_t extra)
+{
+	size_t pad = (align - (buf->size + extra) % align) % align;
+	return arrow_ipc_buf_grow(buf, pad) < 0 ? -1 : 0;
+}
+
+/* {{{ Flatbuffers builder. */
+
+/* Maximum count of fields of a table written. */
+#define ARROW_IPC_FB_FIELDS_MAX 8
+
+/*
+ * Write a table: sizes[i] is the size of the field i (0 if absent, 4 for an
+ * offset), values[i] is its value (ignored for an offset). The positions of
+ * the fields are returned in field_pos to patch the offsets. Returns the
+ * table position.
+ */
+static inline int64_t
+arrow_ipc_fb_table(struct arrow_ipc_buf *fb, int count, const uint8_t *sizes,
+		   const uint64_t *values, size_t *field_pos)
+{
+	uint16_t layout[ARROW_IPC_FB_FIELDS_MAX];
+	size_t table_size = 4; /* The vtable soffset. */
+	for (int i = 0; i < count; i++) {
+		layout[i] = 0;
+		if (sizes[i] == 0)
+			continue;
+		table_size = (table_size + sizes[i] - 1) / sizes[i] * sizes[i];
+		layout[i] = table_size;
+		table_size += sizes[i];
+	}
+
+	/* The table is 8-aligned and the vtable is right before it. */
+	uint16_t vtable[2 + ARROW_IPC_FB_FIELDS_MAX];
+	size_t vtable_size = 4 + 2 * count;
+	vtable[0] = vtable_size;
+	vtable[1] = table_size;
+	memcpy(&vtable[2], layout, 2 * count);
+	if (arrow_ipc_buf_pad(fb, 8, vtable_size) != 0 ||
+	    arrow_ipc_buf_append(fb, vtable, vtable_size) != 0)
+		return -1;
+	int64_t table_pos = arrow_ipc_buf_grow(fb, table_size);
+	if (table_pos < 0)
+		return -1;
+	int32_t soffset = vtable_size;
+	memcpy(fb->data + table_pos, &soffset, sizeof(soffset));
+	for (int i = 0; i < count; i++) {
+		field_pos[i] = table_pos + layout[i];
+		if (sizes[i] != 0)
+			memcpy(fb->data + field_pos[i], &values[i], sizes[i]);
+	}
+	return table_pos;
+}
+
+/* Point the offset at field_pos to the object at target_pos. */
+static inline void
+arrow_ipc_fb_patch(struct arrow_ipc_buf *fb, size_t field_pos,
+		   int64_t target_pos)
+{
+	uint32_t offset = target_pos - field_pos;
+	memcpy(fb->data + field_pos, &offset, sizeof(offset));
+}
+
+/*
+ * Write a vector of count zeroed elements of elem_size, the elements are
+ * aligned to align. Returns the vector position, the elements follow it.
+ */
+static inline int64_t
+arrow_ipc_fb_vector(struct arrow_ipc_buf *fb, uint32_t count,
+		    size_t elem_size, size_t align)
+{
+	if (arrow_ipc_buf_pad(fb, align, sizeof(count)) != 0)
+		return -1;
+	int64_t pos = fb->size;
+	if (arrow_ipc_buf_append(fb, &count, sizeof(count)) != 0 ||
+	    arrow_ipc_buf_grow(fb, count * elem_size) < 0)
+		return -1;
+	return pos;
+}
+
+/* Write a string (a byte vector with a terminating zero). */
+static inline int64_t
+arrow_ipc_fb_string(struct arrow_ipc_buf *fb, const char *str)
+{
+	uint32_t len = strlen(str);
+	if (arrow_ipc_buf_pad(fb, 4, 0) != 0)
+		return -1;
+	int64_t pos = fb->size;
+	if (arrow_ipc_buf_append(fb, &len, sizeof(len)) != 0 ||
+	    arrow_ipc_buf_append(fb, str, len + 1) != 0)
+		return -1;
+	return pos;
+}
+
+/* }}} */
+
+/* The values of the Arrow flatbuffers enums used. */
+enum {
+	ARROW_IPC_METADATA_V5 = 4,
+	ARROW_IPC_HEADER_SCHEMA = 1,
+	ARROW_IPC_HEADER_RECORD_BATCH = 3,
+	ARROW_IPC_TYPE_INT = 2,
+	ARROW_IPC_TYPE_FLOATING_POINT = 3,
+	ARROW_IPC_TYPE_BINARY = 4,
+	ARROW_IPC_TYPE_UTF8 = 5,
+	ARROW_IPC_TYPE_BOOL = 6,
+	ARROW_IPC_PRECISION_SINGLE = 1,
+	ARROW_IPC_PRECISION_DOUBLE = 2,
+};
+
+/* The IPC type of a column by its C data interface format string. */
+struct arrow_ipc_type {
+	uint8_t type_type;
+	/* The value width in bits: 1 for bool, 0 for utf8 and binary. */
+	int bit_width;
+	bool is_signed;
+};
+
+static inline bool
+arrow_ipc_type_by_format(const char *format, struct arrow_ipc_type *type)
+{
+	if (format == NULL || format[0] == '\0' || format[1] != '\0')
+		return false;
+	type->is_signed = false;
+	switch (format[0]) {
+	case 'c': case 's': case 'i': case 'l':
+		type->is_signed = true;
+		/* FALLTHROUGH */
+	case 'C': case 'S': case 'I': case 'L':
+		type->type_type = ARROW_IPC_TYPE_INT;
+		type->bit_width = format[0] == 'c' || format[0] == 'C' ? 8 :
+				  format[0] == 's' || format[0] == 'S' ? 16 :
+				  format[0] == 'i' || format[0] == 'I' ? 32 : 64;
+		return true;
+	case 'f':
+		type->type_type = ARROW_IPC_TYPE_FLOATING_POINT;
+		type->bit_width = 32;
+		return true;
+	case 'g':
+		type->type_type = ARROW_IPC_TYPE_FLOATING_POINT;
+		type->bit_width = 64;
+		return true;
+	case 'b':
+		type->type_type = ARROW_IPC_TYPE_BOOL;
+		type->bit_width = 1;
+		return true;
+	case 'u':
+		type->type_type = ARROW_IPC_TYPE_UTF8;
+		type->bit_width = 0;
+		return true;
+	case 'z':
+		type->type_type = ARROW_IPC_TYPE_BINARY;
+		type->bit_width = 0;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Check if the column of the format can be written. */
+static inline bool
+arrow_ipc_format_is_supported(const char *format)
+{
+	struct arrow_ipc_type type;
+	return arrow_ipc_type_by_format(format, &type);
+}
+
+/* The IPC stream writer, the messages are appended to out. */
+struct arrow_ipc_writer {
+	struct arrow_ipc_buf out;
+	/* The flatbuffers metadata of the message being written. */
+	struct arrow_ipc_buf fb;
+};
+
+static inline void
+arrow_ipc_writer_destroy(struct arrow_ipc_writer *writer)
+{
+	free(writer->out.data);
+	free(writer->fb.data);
+}
+
+/*
+ * Start a message: the flatbuffer root offset and the Message table. The
+ * field_pos are the positions of the Message fields: version, header_type,
+ * header and bodyLength.
+ */
+static inline int
+arrow_ipc_message_begin(struct arrow_ipc_writer *writer, uint8_t header_type,
+			size_t *field_pos)
+{
+	struct arrow_ipc_buf *fb = &writer->fb;
+	fb->size = 0;
+	const uint8_t sizes[] = {2, 1, 4, 8};
+	const uint64_t values[] = {ARROW_IPC_METADATA_V5, header_type, 0, 0};
+	if (arrow_ipc_buf_grow(fb, 4) < 0)
+		return -1;
+	int64_t message_pos = arrow_ipc_fb_table(fb, 4, sizes, values,
+						 field_pos);
+	if (message_pos < 0)
+		return -1;
+	arrow_ipc_fb_patch(fb, 0, message_pos);
+	return 0;
+}
+
+/* Write the encapsulated message: the prefix and the padded metadata. */
+static inline int
+arrow_ipc_message_end(struct arrow_ipc_writer *writer)
+{
+	struct arrow_ipc_buf *fb = &writer->fb;
+	if (arrow_ipc_buf_pad(fb, 8, 0) != 0)
+		return -1;
+	uint32_t prefix[2] = {0xFFFFFFFF, (uint32_t)fb->size};
+	if (arrow_ipc_buf_append(&writer->out, prefix, sizeof(prefix)) != 0 ||
+	    arrow_ipc_buf_append(&writer->out, fb->data, fb->size) != 0)
+		return -1;
+	return 0;
+}
+
+/* Write the Field table of the column. */
+static inline int64_t
+arrow_ipc_write_field(struct arrow_ipc_buf *fb, const char *name,
+		      const struct arrow_ipc_type *type)
+{
+	/* name, nullable, type_type, type, dictionary, children. */
+	const uint8_t sizes[] = {4, 1, 1, 4, 0, 4};
+	const uint64_t values[] = {0, 1, type->type_type, 0, 0, 0};
+	size_t field_pos[6];
+	int64_t pos = arrow_ipc_fb_table(fb, 6, sizes, values, field_pos);
+	if (pos < 0)
+		return -1;
+
+	/* The type table. */
+	int64_t type_pos;
+	size_t type_field_pos[2];
+	if (type->type_type == ARROW_IPC_TYPE_INT) {
+		/* bitWidth, is_signed. */
+		const uint8_t type_sizes[] = {4, 1};
+		const uint64_t type_values[] = {(uint64_t)type->bit_width,
+						type->is_signed};
+		type_pos = arrow_ipc_fb_table(fb, 2, type_sizes, type_values,
+					      type_field_pos);
+	} else if (type->type_type == ARROW_IPC_TYPE_FLOATING_POINT) {
+		/* precision. */
+		const uint8_t type_sizes[] = {2};
+		const uint64_t type_values[] = {
+			type->bit_width == 32 ? ARROW_IPC_PRECISION_SINGLE :
+						ARROW_IPC_PRECISION_DOUBLE,
+		};
+		type_pos = arrow_ipc_fb_table(fb, 1, type_sizes, type_values,
+					      type_field_pos);
+	} else {
+		/* Bool, Utf8 and Binary have no fields. */
+		type_pos = arrow_ipc_fb_table(fb, 0, NULL, NULL,
+					      type_field_pos);
+	}
+	if (type_pos < 0)
+		return -1;
+	arrow_ipc_fb_patch(fb, field_pos[3], type_pos);
+
+	/* The name and the empty children vector. */
+	int64_t name_pos = arrow_ipc_fb_string(fb, name);
+	if (name_pos < 0)
+		return -1;
+	arrow_ipc_fb_patch(fb, field_pos[0], name_pos);
+	int64_t children_pos = arrow_ipc_fb_vector(fb, 0, 4, 4);
+	if (children_pos < 0)
+		return -1;
+	arrow_ipc_fb_patch(fb, field_pos[5], children_pos);
+	return pos;
+}
+
+/*
+ * Write the schema message. The column names are taken from the schema
+ * children, the unnamed columns are named by their numbers.
+ */
+static inline int
+arrow_ipc_write_schema(struct arrow_ipc_writer *writer,
+		       const struct ArrowSchema *schema)
+{
+	struct arrow_ipc_buf *fb = &writer->fb;
+	size_t message_pos[4];
+	if (arrow_ipc_message_begin(writer, ARROW_IPC_HEADER_SCHEMA,
+				    message_pos) != 0)
+		return -1;
+
+	/* endianness (little), fields. */
+	const uint8_t sizes[] = {2, 4};
+	const uint64_t values[] = {0, 0};
+	size_t schema_field_pos[2];
+	int64_t schema_pos = arrow_ipc_fb_table(fb, 2, sizes, values,
+						schema_field_pos);
+	if (schema_pos < 0)
+		return -1;
+	arrow_ipc_fb_patch(fb, message_pos[2], schema_pos);
+	int64_t fields_pos = arrow_ipc_fb_vector(fb, schema->n_children, 4, 4);
+	if (fields_pos < 0)
+		return -1;
+	arrow_ipc_fb_patch(fb, schema_field_pos[1], fields_pos);
+	for (int64_t i = 0; i < schema->n_children; i++) {
+		const struct ArrowSchema *child = schema->children[i];
+		struct arrow_ipc_type type;
+		if (!arrow_ipc_type_by_format(child->format, &type))
+			return -1;
+		char name[16];
+		if (child->name == NULL)
+			snprintf(name, sizeof(name), "%lld", (long long)i);
+		int64_t field_pos = arrow_ipc_write_field(
+			fb, child->name != NULL ? child->name : name, &type);
+		if (field_pos < 0)
+			return -1;
+		arrow_ipc_fb_patch(fb, fields_pos + 4 + 4 * i, field_pos);
+	}
+	return arrow_ipc_message_end(writer);
+}
+
+/* The buffers of the first length values of a column. */
+struct arrow_ipc_column {
+	const void *buffers[3];
+	int64_t sizes[3];
+	int buffer_count;
+	int64_t null_count;
+};
+
+static inline int
+arrow_ipc_column_create(struct arrow_ipc_column *column,
+			const struct ArrowSchema *schema,
+			const struct ArrowArray *array, int64_t length)
+{
+	struct arrow_ipc_type type;
+	if (!arrow_ipc_type_by_format(schema->format, &type) ||
+	    array->offset != 0 || length > array->length)
+		return -1;
+
+	/* The validity bitmap, omitted if there are no nulls. */
+	column->null_count = 0;
+	column->buffers[0] = NULL;
+	column->sizes[0] = 0;
+	if (array->null_count != 0 && array->buffers[0] != NULL) {
+		const uint8_t *bits = (const uint8_t *)array->buffers[0];
+		int64_t valid_count = 0;
+		for (int64_t i = 0; i < length / 8; i++)
+			valid_count += __builtin_popcount(bits[i]);
+		if (length % 8 != 0) {
+			uint8_t mask = (1 << (length % 8)) - 1;
+			valid_count += __builtin_popcount(bits[length / 8] &
+							  mask);
+		}
+		column->null_count = length - valid_count;
+		if (column->null_count != 0) {
+			column->buffers[0] = bits;
+			column->sizes[0] = (length + 7) / 8;
+		}
+	}
+
+	/* The values. */
+	column->buffers[1] = array->buffers[1];
+	if (type.bit_width != 0) {
+		column->buffer_count = 2;
+		column->sizes[1] = (length * type.bit_width + 7) / 8;
+		return 0;
+	}
+	const int32_t *offsets = (const int32_t *)array->buffers[1];
+	if (offsets[0] != 0)
+		return -1;
+	column->buffer_count = 3;
+	column->sizes[1] = (length + 1) * sizeof(*offsets);
+	column->buffers[2] = array->buffers[2];
+	column->sizes[2] = offsets[length];
+	return 0;
+}
+
+/* The size of a body buffer, the buffers are padded to 8 bytes. */
+static inline int64_t
+arrow_ipc_body_size(int64_t size)
+{
+	return (size + 7) / 8 * 8;
+}
+
+/*
+ * Write the first length rows of the array (a struct of the schema
+ * columns) as a record batch message.
+ */
+static inline int
+arrow_ipc_write_batch(struct arrow_ipc_writer *writer,
+		      const struct ArrowSchema *schema,
+		      const struct ArrowArray *array, int64_t length)
+{
+	if (array->offset != 0 || array->n_children != schema->n_children)
+		return -1;
+	struct arrow_ipc_buf *fb = &writer->fb;
+	size_t message_pos[4];
+	if (arrow_ipc_message_begin(writer, ARROW_IPC_HEADER_RECORD_BATCH,
+				    message_pos) != 0)
+		return -1;
+
+	/* length, nodes, buffers. */
+	const uint8_t sizes[] = {8, 4, 4};
+	const uint64_t values[] = {(uint64_t)length, 0, 0};
+	size_t batch_field_pos[3];
+	int64_t batch_pos = arrow_ipc_fb_table(fb, 3, sizes, values,
+					       batch_field_pos);
+	if (batch_pos < 0)
+		return -1;
+	arrow_ipc_fb_patch(fb, message_pos[2], batch_pos);
+
+	/* The FieldNode structs: length, null_count. */
+	int64_t column_count = schema->n_children;
+	int64_t nodes_pos = arrow_ipc_fb_vector(fb, column_count, 16, 8);
+	if (nodes_pos < 0)
+		return -1;
+	arrow_ipc_fb_patch(fb, batch_field_pos[1], nodes_pos);
+	int64_t buffer_count = 0;
+	for (int64_t i = 0; i < column_count; i++) {
+		struct arrow_ipc_column column;
+		if (arrow_ipc_column_create(&column, schema->children[i],
+					    array->children[i], length) != 0)
+			return -1;
+		int64_t node[2] = {length, column.null_count};
+		memcpy(fb->data + nodes_pos + 4 + 16 * i, node, sizeof(node));
+		buffer_count += column.buffer_count;
+	}
+
+	/* The Buffer structs: offset, length. */
+	int64_t buffers_pos = arrow_ipc_fb_vector(fb, buffer_count, 16, 8);
+	if (buffers_pos < 0)
+		return -1;
+	arrow_ipc_fb_patch(fb, batch_field_pos[2], buffers_pos);
+	int64_t body_size = 0;
+	char *buffer_desc = fb->data + buffers_pos + 4;
+	for (int64_t i = 0; i < column_count; i++) {
+		struct arrow_ipc_column column;
+		arrow_ipc_column_create(&column, schema->children[i],
+					array->children[i], length);
+		for (int j = 0; j < column.buffer_count; j++) {
+			int64_t buffer[2] = {body_size, column.sizes[j]};
+			memcpy(buffer_desc, buffer, sizeof(buffer));
+			buffer_desc += sizeof(buffer);
+			body_size += arrow_ipc_body_size(column.sizes[j]);
+		}
+	}
+	memcpy(fb->data + message_pos[3], &body_size, sizeof(body_size));
+	if (arrow_ipc_message_end(writer) != 0)
+		return -1;
+
+	/* The body. */
+	for (int64_t i = 0; i < column_count; i++) {
+		struct arrow_ipc_column column;
+		arrow_ipc_column_create(&column, schema->children[i],
+					array->children[i], length);
+		for (int j = 0; j < column.buffer_count; j++) {
+			int64_t size = column.sizes[j];
+			if (arrow_ipc_buf_append(&writer->out,
+						 column.buffers[j], size) != 0 ||
+			    arrow_ipc_buf_grow(&writer->out,
+					       arrow_ipc_body_size(size) -
+					       size) < 0)
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/* Write the end of stream marker. */
+static inline int
+arrow_ipc_write_eos(struct arrow_ipc_writer *writer)
+{
+	const uint32_t eos[2] = {0xFFFFFFFF, 0};
+	return arrow_ipc_buf_append(&writer->out, eos, sizeof(eos));
+}
@@ -0,0 +1,188 @@
+/*
+ * Micro-benchmark of the uint64 key column encoders: the two-pass path
+ * (size each key, then encode it) vs the single pass mp_uint64_keys.h.
+ */
+
+#include "msgpuck.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "mp_uint64_keys.h"
+
+#define lengthof(array) (sizeof (array) / sizeof ((array)[0]))
+
+#define ERROR_FATAL(fmt, ...) do { printf(fmt "\n", ## __VA_ARGS__); exit(1); } while (0)
+
+/* Count of values encoded for each measurement. */
+#define VALUES_PER_RUN (64 * 1024 * 1024)
+
+static uint64_t
+nsecs(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000000000llu + t.tv_nsec;
+}
+
+static uint64_t
+xorshift64(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+/* Sizing pass and then encoding pass, as done by the generic codecs. */
+static char *
+encode_two_pass(const uint64_t *values, int count, char **bounds,
+		char *data)
+{
+	ptrdiff_t *sizes = (ptrdiff_t *)bounds;
+	for (int i = 0; i < count; i++) {
+		ptrdiff_t size = 0;
+		mp_encode_array_safe(NULL, &size, 1);
+		mp_encode_uint_safe(NULL, &size, values[i]);
+		sizes[i] = -size;
+	}
+	for (int i = 0; i < count; i++) {
+		ptrdiff_t size = sizes[i];
+		bounds[i] = data;
+		data = mp_encode_array_safe(data, NULL, 1);
+		data = mp_encode_uint_safe(data, NULL, values[i]);
+		if (data - bounds[i] != size)
+			ERROR_FATAL("Unexpected key size");
+	}
+	bounds[count] = data;
+	return data;
+}
+
+typedef char *(*encode_f)(const uint64_t *values, int count, char **bounds,
+			  char *data);
+
+static const struct {
+	const char *name;
+	encode_f encode;
+	/* Set if the encoder must only be run on the AVX2 capable CPUs. */
+	bool needs_avx2;
+} encoders[] = {
+	{"two_pass", encode_two_pass, false},
+	{"single_pass_scalar", mp_encode_uint64_keys_scalar, false},
+#if defined(__x86_64__)
+	{"single_pass_avx2", mp_encode_uint64_keys_avx2, true},
+#endif
+};
+
+static bool
+encoder_is_supported(unsigned i)
+{
+#if defined(__x86_64__)
+	if (encoders[i].needs_avx2)
+		return __builtin_cpu_supports("avx2");
+#endif
+	return !encoders[i].needs_avx2;
+}
+
+enum dataset {
+	/* Like the incrementing 30M space primary key. */
+	DATASET_INCREMENTING,
+	/* Values of random width class. */
+	DATASET_RANDOM_WIDTH,
+	/* Random 64-bit values. */
+	DATASET_RANDOM,
+	dataset_MAX,
+};
+
+static const char *dataset_strs[] = {
+	/* [DATASET_INCREMENTING] = */ "incrementing",
+	/* [DATASET_RANDOM_WIDTH] = */ "random_width",
+	/* [DATASET_RANDOM]       = */ "random",
+};
+
+static_assert(lengthof(dataset_strs) == dataset_MAX,
+	      "Each dataset must be present in dataset_strs");
+
+static void
+dataset_fill(enum dataset dataset, uint64_t *values, int count)
+{
+	static const uint64_t width_masks[] = {
+		0x7f, 0xff, 0xffff, 0xffffffff, UINT64_MAX,
+	};
+	uint64_t state = 0x9e3779b97f4a7c15ull;
+	for (int i = 0; i < count; i++) {
+		uint64_t random = xorshift64(&state);
+		switch (dataset) {
+		case DATASET_INCREMENTING:
+			values[i] = 27000000 + i;
+			break;
+		case DATASET_RANDOM_WIDTH:
+			values[i] = random & width_masks[random % 5];
+			break;
+		default:
+			values[i] = random;
+			break;
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	const int batch_size_max = 65536;
+	uint64_t *values = (uint64_t *)malloc(sizeof(*values) * batch_size_max);
+	char **bounds = (char **)malloc(sizeof(*bounds) * (batch_size_max + 1));
+	char **check_bounds =
+		(char **)malloc(sizeof(*bounds) * (batch_size_max + 1));
+	size_t data_size = mp_uint64_keys_size_max(batch_size_max);
+	char *data = (char *)malloc(data_size);
+	char *check_data = (char *)malloc(data_size);
+	if (values == NULL || bounds == NULL || check_bounds == NULL ||
+	    data == NULL || check_data == NULL)
+		ERROR_FATAL("Couldn't allocate the buffers");
+
+	printf("%-14s %-10s", "dataset", "batch_size");
+	for (unsigned i = 0; i < lengthof(encoders); i++)
+		printf(" %20s", encoders[i].name);
+	printf("   (ns per key)\n");
+
+	for (int dataset = 0; dataset < dataset_MAX; dataset++) {
+		dataset_fill((enum dataset)dataset, values, batch_size_max);
+		for (int batch_size = 128; batch_size <= batch_size_max;
+		     batch_size *= 2) {
+			/* Make sure all the encoders give the same result. */
+			char *check_end = encode_two_pass(values, batch_size,
+							  check_bounds,
+							  check_data);
+			printf("%-14s %-10d", dataset_strs[dataset], batch_size);
+			for (unsigned i = 0; i < lengthof(encoders); i++) {
+				if (!encoder_is_supported(i)) {
+					printf(" %20s", "n/a");
+					continue;
+				}
+				char *end = encoders[i].encode(
+					values, batch_size, bounds, data);
+				if (end - data != check_end - check_data ||
+				    memcmp(data, check_data, end - data) != 0)
+					ERROR_FATAL("Wrong %s result",
+						    encoders[i].name);
+
+				int runs = VALUES_PER_RUN / batch_size;
+				uint64_t t0 = nsecs();
+				for (int run = 0; run < runs; run++) {
+					encoders[i].encode(values, batch_size,
+							   bounds, data);
+					__asm__ volatile("" : : "r"(data) :
+							 "memory");
+				}
+				uint64_t t1 = nsecs();
+				printf(" %20.03f", (double)(t1 - t0) /
+						   ((double)runs * batch_size));
+			}
+			printf("\n");
+		}
+	}
+	return 0;
+}
@@ -1,15 +1,27 @@
-local space_size = 30000
-local space_engine = 'memcs'
+local space_size = tonumber(os.getenv('SPACE_SIZE')) or 30000
+local space_engine = os.getenv('SPACE_ENGINE') or 'memcs'
 local repetition_count = nil      -- Default: arg[2] if exists, 10 if arg[1] exists, 1 othervice.
 local repetition_count_warmup = 0 -- Default: no warm-up.
 
 -- User PoV tuning options.
 local in_one_transaction = true
 local batch_size = 1000
+local commit_every = 100 -- Batches per transaction in the *_chunked tests.
+local secondary_key_count = tonumber(os.getenv('SECONDARY_KEY_COUNT')) or 0
+local lookahead_sizes = {1, 2, 4, 8, 16, 32, 64} -- The *_lookahead tests.
 local wal_mode = 'write'
+local iproto_listen = os.getenv('LISTEN') or 'unix/:./iproto.sock' -- The *_iproto tests.
+local select_chunk_rows = 1000 -- The select_until_* tests.
+local select_chunk_bytes = 1024 * 1024
+local select_columns_batch_limit = 16 -- Batches per select_columns_until_c call.
 
--- The indexes used to delete/update/select.
-local search_index_name = 'pk'
+-- The tree stats of the search index are appended here before each test as
+-- JSON lines, see the 0004-PoC-tree-stats-API-instead-of-doit.patch.
+local tree_stat_path = 'tree_stat.jsonl'
+
+-- The indexes used to delete/update/select. Set the search index to 'sk1' to
+-- drop by a secondary key (like TTL), see secondary_key_count.
+local search_index_name = os.getenv('SEARCH_INDEX') or 'pk'
 local write_index_name = 'pk'
 
 -- Lookup options.
@@ -20,13 +32,35 @@ local until_key_part_count = 1
 
 -- The data schema.
 local format = {
-    {name = 'id', type = 'unsigned', generator = {name = 'incrementing'}}, -- 123456789
+    {name = 'id', type = 'unsigned', generator = {name = os.getenv('ID_GENERATOR') or 'incrementing'}}, -- 123456789
     {name = 'non_unique', type = 'unsigned', generator = {name = 'random', min = 1, max = 100}}, -- 887241132
 --    {name = 'long_step', type = 'unsigned', generator = {name = 'long_step', step_size = 100}}, -- 111222333
 --    {name = 'repeating', type = 'unsigned', generator = {name = 'repeating', steps = 100}}, -- 123123123
 --    {name = 'unique', type = 'unsigned', generator = {name = 'random_unique'}}, -- 975642138
 }
 
+-- SPACE_FORMAT=payments: the 13 fields of the test space of the
+-- 2_memcs_vs_pg_latency filled the same way, but the id is unsigned to keep
+-- the range keys numeric.
+if os.getenv('SPACE_FORMAT') == 'payments' then
+    local now = os.time()
+    format = {
+        {name = 'id', type = 'unsigned', generator = {name = os.getenv('ID_GENERATOR') or 'incrementing'}},
+        {name = 'client_id', type = 'string', generator = {name = 'repeating_string', prefix = 'some client ', steps = 10}},
+        {name = 'pan', type = 'string', generator = {name = 'repeating_string', prefix = 'some pan ', steps = 10}},
+        {name = 'ts', type = 'int64', generator = {name = 'random', min = now - 100000, max = now}},
+        {name = 'msg_type', type = 'int64', generator = {name = 'choice', values = {10, 20, 30, 40, 50, 60, 70, 80, 90}}},
+        {name = 'mcc', type = 'string', generator = {name = 'choice', values = {'1'}}},
+        {name = 'de22', type = 'string', generator = {name = 'choice', values = {'1'}}},
+        {name = 'de3', type = 'string', generator = {name = 'choice', values = {'100', '200', '300', '400', '500', '600', '700'}}},
+        {name = 'mti', type = 'string', generator = {name = 'choice', values = {'0300', '0310', '0320', '0330', '0400', '0410', '0420', '0430'}}},
+        {name = 'response', type = 'string', generator = {name = 'choice', values = {'some response'}}},
+        {name = 'country', type = 'string', generator = {name = 'choice', values = {'112', '192', '643', '792'}}},
+        {name = 'msg_mode', type = 'string', generator = {name = 'choice', values = {'P', 'T', 'C', 'D', 'L', 'A', 'X'}}},
+        {name = 'amount', type = 'int64', generator = {name = 'random', min = 0, max = 10000}},
+    }
+end
+
 local indexes = {
     {name = 'pk', opts = {parts = {{'id', 'unsigned'}}, unique = true}},
 --    {name = 'non_unique', opts = {parts = {{'non_unique', 'unsigned'}}, unique = false}},
@@ -36,6 +70,13 @@ local indexes = {
 --    {name = 'unique', opts = {parts = {{'unique', 'unsigned'}}, unique = true}},
 }
 
+-- The extra secondary keys: sk1..skN on own random unique fields.
+for i = 1, secondary_key_count do
+    local name = 'sk' .. i
+    table.insert(format, {name = name, type = 'unsigned', generator = {name = 'random_unique'}})
+    table.insert(indexes, {name = name, opts = {parts = {{name, 'unsigned'}}, unique = true}})
+end
+
 local field_by_name = {}
 for fieldno, field in pairs(format) do
     field_by_name[field.name] = field
@@ -74,6 +115,26 @@ local function repeating(steps)
         return i % steps
     end
 end
+local function repeating_string(prefix, steps)
+    return function(i)
+        if i == -1 then
+            return 'repeating string, steps: ' .. steps
+        end
+        return prefix .. i % steps
+    end
+end
+local function choice(values)
+    local picks = {}
+    for i = 1, space_size do
+        picks[i] = values[math.random(#values)]
+    end
+    return function(i)
+        if i == -1 then
+            return 'one of ' .. #values .. ' values'
+        end
+        return picks[i]
+    end
+end
 local function random(min, max)
     local values = {}
     for i = 1, space_size do
@@ -86,19 +147,21 @@ local function random(min, max)
         return values[i]
     end
 end
-local random_unique_values = {}
-for i = 1, space_size do
-    random_unique_values[i] = i
-end
-for i = #random_unique_values, 2, -1 do
-    local j = math.random(i)
-    random_unique_values[i], random_unique_values[j] = random_unique_values[j], random_unique_values[i]
-end
-local function random_unique(i)
-    if i == -1 then
-        return 'random unique'
+local function random_unique()
+    local values = {}
+    for i = 1, space_size do
+        values[i] = i
+    end
+    for i = #values, 2, -1 do
+        local j = math.random(i)
+        values[i], values[j] = values[j], values[i]
+    end
+    return function(i)
+        if i == -1 then
+            return 'random unique'
+        end
+        return values[i]
     end
-    return random_unique_values[i]
 end
 
 local gen_field_value = {}
@@ -116,10 +179,17 @@ for fieldno, field in pairs(format) do
     elseif field.generator.name == 'repeating' then
         -- 123123123
         gen_field_value[fieldno] = repeating(field.generator.steps)
+    elseif field.generator.name == 'repeating_string' then
+        -- a1 a2 a3 a1 a2 a3
+        gen_field_value[fieldno] = repeating_string(field.generator.prefix,
+                                                    field.generator.steps)
+    elseif field.generator.name == 'choice' then
+        -- b a c c a b
+        gen_field_value[fieldno] = choice(field.generator.values)
     else
         -- 975642138
         assert(field.generator.name == 'random_unique')
-        gen_field_value[fieldno] = random_unique
+        gen_field_value[fieldno] = random_unique()
     end
     format[fieldno].generator = nil
 end
@@ -140,12 +210,36 @@ local fio = require('fio')
 local clock = require('clock')
 local fiber = require('fiber')
 local key_def = require('key_def')
+local json = require('json')
+local popen = require('popen')
 
 local function log(s)
     io.stdout:write(s)
     io.stdout:flush()
 end
 
+-- The current and the peak resident set size of the process in KB, nil if
+-- /proc is not available.
+local function rss()
+    local file = io.open('/proc/self/status')
+    if file == nil then
+        return nil
+    end
+    local status = file:read('*a')
+    file:close()
+    return tonumber(status:match('VmRSS:%s*(%d+) kB')),
+           tonumber(status:match('VmHWM:%s*(%d+) kB'))
+end
+
+-- Reset the peak resident set size to the current one (Linux 4.0+).
+local function peak_rss_reset()
+    local file = io.open('/proc/self/clear_refs', 'w')
+    if file ~= nil then
+        file:write('5')
+        file:close()
+    end
+end
+
 local function clear()
     for _, file in pairs(fio.glob('./000*.snap')) do
         fio.unlink(file)
@@ -156,11 +250,13 @@ local function clear()
     for _, file in pairs(fio.glob('./000*.vylog')) do
         fio.unlink(file)
     end
+    fio.unlink('./iproto.sock')
 end
 
 clear()
 box.cfg {
     wal_mode = wal_mode,
+    listen = iproto_listen,
     too_long_threshold = 100500,
     memtx_use_mvcc_engine = false,
     memtx_memory = 1024 * 1024 * 1024 * 28,
@@ -275,6 +371,54 @@ local function space_is_memcs_filter()
     return space_engine == 'memcs';
 end
 
+-- Filter for functions relying on the tuple pointer stability.
+local function space_is_memtx_filter()
+    return space_engine == 'memtx';
+end
+
+-- Filter for functions ordering the work by the write index.
+local function search_index_is_not_write_index_filter()
+    return search_index.id ~= write_index.id
+end
+
+-- Filter for the batch iterator API (0002-PoC-box_iterator_next_batch.patch).
+local function has_next_batch_filter()
+    local ffi = require('ffi')
+    pcall(ffi.cdef, [[
+        int box_iterator_next_batch(void *it, void **tuples, uint32_t size,
+                                    uint32_t *count);
+    ]])
+    return (pcall(function() return ffi.C.box_iterator_next_batch end))
+end
+
+-- Filter for the borrowed tuple iterator API (0007-PoC-BOX_ITER_NOREF patch).
+local function has_iterator_noref_filter()
+    local ffi = require('ffi')
+    pcall(ffi.cdef, [[
+        void *box_index_iterator_ex(uint32_t space_id, uint32_t index_id,
+                                    int type, const char *key,
+                                    const char *key_end, uint32_t flags);
+    ]])
+    return space_engine == 'memtx' and
+           (pcall(function() return ffi.C.box_index_iterator_ex end))
+end
+
+-- Filter for the memtx range deletion API (0003-PoC-memtx-tree-delete_range
+-- patch): the range is given in the primary key.
+local function delete_range_c_filter()
+    local ffi = require('ffi')
+    pcall(ffi.cdef, [[
+        int box_index_delete_range(uint32_t space_id, uint32_t index_id,
+                                   const char *from_key,
+                                   const char *from_key_end,
+                                   const char *until_key,
+                                   const char *until_key_end);
+    ]])
+    return space_engine == 'memtx' and
+           search_index.id == 0 and write_index.id == 0 and
+           (pcall(function() return ffi.C.box_index_delete_range end))
+end
+
 -- Filter for range deletion API.
 local function delete_range_filter()
     -- The space is MemCS and the index.delete_range method exists.
@@ -389,6 +533,53 @@ local function delete_until_c_batched()
     assert(s:len() == space_size - process_count)
 end
 
+-- Deletes tuples by batches in C committing each commit_every batches and
+-- yielding in between. Overheads are the same as in delete_until_c_batched,
+-- plus:
+-- - a lookup after each yield (to resume from the last deleted key).
+-- - a WAL write per commit_every batches.
+local function delete_until_c_batched_chunked()
+    local stat =
+        box.func['procs.delete_until_c_batched']:call({s.id, search_index.id,
+                                                       write_index.id,
+                                                       kd_c_parts,
+                                                       from_key, until_key,
+                                                       batch_size,
+                                                       commit_every})
+    assert(s:len() == space_size - process_count)
+    return stat
+end
+
+-- Deletes tuples by batches in C sorting each batch in the write index order
+-- before deleting it, so the deletions go to neighbour leaves of the write
+-- index. Overheads are the same as in delete_until_c_batched, plus:
+-- - sort of each batch (radix sort if the write key is a single unsigned).
+-- - reference of each deleted tuple (if not the radix sort).
+local function delete_until_c_batched_sorted()
+    box.func['procs.delete_until_c_batched']:call({s.id, search_index.id,
+                                                   write_index.id, kd_c_parts,
+                                                   from_key, until_key,
+                                                   batch_size, 0,
+                                                   true})
+    assert(s:len() == space_size - process_count)
+end
+
+-- Deletes tuples by batches in C fetching the tuples lookahead steps ahead
+-- and prefetching them. Overheads are the same as in delete_until_c_batched,
+-- plus:
+-- - a field lookup per tuple to prefetch its data.
+-- The tuples ahead are not referenced, so MemTX only.
+box.schema.func.create('procs.delete_until_c_batched_lookahead',
+                       {language = 'C', if_not_exists = true})
+local function delete_until_c_batched_lookahead(lookahead)
+    return function()
+        box.func['procs.delete_until_c_batched_lookahead']:call({
+            s.id, search_index.id, write_index.id, kd_c_parts,
+            from_key, until_key, batch_size, lookahead})
+        assert(s:len() == space_size - process_count)
+    end
+end
+
 -- Deletes tuples by batches in C. Overheads:
 -- - a lookup to find the amount to delete.
 -- - a lookup each batch_size steps (iterator invalidation).
@@ -419,6 +610,20 @@ local function delete_until_c_nocmp_arrow()
     assert(s:len() == space_size - process_count)
 end
 
+-- Deletes tuples using the memtx range deletion API in C, see the
+-- 0003-PoC-memtx-tree-delete_range.patch. Overheads:
+-- - a DELETE statement written to WAL for each tuple.
+-- - remove each tuple from the secondary keys.
+-- - a primary key descent per leaf of the range.
+-- Can't be called in a transaction, refused if a read view is open.
+box.schema.func.create('procs.delete_until_c_range_api',
+                       {language = 'C', if_not_exists = true})
+local function delete_until_c_range_api()
+    box.func['procs.delete_until_c_range_api']:call({s.id, write_index.id,
+                                                     from_key, until_key})
+    assert(s:len() == space_size - process_count)
+end
+
 -- Update until the end key using regular Lua iterators. Overheads:
 -- - a lookup each step (iterator invalidation).
 -- - compare each tuple with the end key.
@@ -502,6 +707,63 @@ local function update_until_c_batched()
                                                    batch_size})
 end
 
+-- Updates tuples by batches in C committing each commit_every batches and
+-- yielding in between. Overheads are the same as in update_until_c_batched,
+-- plus a WAL write per commit_every batches.
+local function update_until_c_batched_chunked()
+    return box.func['procs.update_until_c_batched']:call({s.id,
+                                                          search_index.id,
+                                                          write_index.id,
+                                                          kd_c_parts,
+                                                          {{'=', 'non_unique',
+                                                            0}},
+                                                          from_key, until_key,
+                                                          batch_size,
+                                                          commit_every})
+end
+
+-- The columns of the bulk update: the write keys of the range (single part
+-- key values or key arrays) and the new values of the non_unique field. Built
+-- by the bulk_update_c setup, not timed.
+local bulk_update_columns
+local bulk_update_key_parts = {}
+for i, part in ipairs(write_index.parts) do
+    table.insert(bulk_update_key_parts, i - 1)
+    table.insert(bulk_update_key_parts, part.type)
+end
+
+local function bulk_update_setup()
+    if bulk_update_columns ~= nil then
+        return
+    end
+    local keys = {}
+    local values = {}
+    for _, tuple in search_index:pairs(from_key, {iterator = 'GE'}) do
+        -- Break if the until key reached.
+        if kd:compare_with_key(tuple, until_key) == 0 then
+            break
+        end
+        local key = write_kd:extract_key(tuple)
+        table.insert(keys, #key == 1 and key[1] or key)
+        table.insert(values, #values % 100 + 1)
+    end
+    assert(#keys == process_count)
+    bulk_update_columns = {keys, values}
+end
+
+-- Updates each tuple with its own value given by the columns in C. Overheads:
+-- - a lookup per tuple (by the write key).
+-- - generate the operations of each tuple from the template.
+-- - sort each batch of keys in the write index order.
+box.schema.func.create('procs.bulk_update_c',
+                       {language = 'C', if_not_exists = true})
+local function bulk_update_c()
+    box.func['procs.bulk_update_c']:call({s.id, write_index.id,
+                                          bulk_update_key_parts,
+                                          {{'=', 'non_unique', 1}},
+                                          bulk_update_columns, batch_size})
+end
+
 -- Select tuples from beginning up to some range end.
 local function process_until_lua()
     local processed = 0
@@ -538,7 +800,333 @@ local function process_until_c()
                                             kd_c_parts, from_key, until_key})
 end
 
-local function bench(name, func, cleanup)
+-- Same as process_until_c, but the iterator returns the borrowed tuples
+-- (BOX_ITER_NOREF, see the 0007-PoC-BOX_ITER_NOREF-borrowed-tuple-iterator
+-- patch): no tuple reference and blessing per tuple.
+local function process_until_c_noref()
+    box.func['procs.process_until_c']:call({s.id, search_index.id,
+                                            kd_c_parts, from_key, until_key,
+                                            true})
+end
+
+-- Select tuples up until the range end in C fetching the tuples lookahead
+-- steps ahead and prefetching them. Overheads:
+-- - a field lookup per tuple to prefetch its data.
+-- The tuples ahead are not referenced, so MemTX only.
+box.schema.func.create('procs.process_until_c_lookahead',
+                       {language = 'C', if_not_exists = true})
+local function process_until_c_lookahead(lookahead)
+    return function()
+        box.func['procs.process_until_c_lookahead']:call({
+            s.id, search_index.id, kd_c_parts, from_key, until_key,
+            lookahead})
+    end
+end
+
+-- Select tuples up until the range end in C. Overheads:
+-- - a lookup to find the first tuple out of the range.
+box.schema.func.create('procs.process_range_c',
+                       {language = 'C', if_not_exists = true})
+local function process_range_c()
+    box.func['procs.process_range_c']:call({s.id, search_index.id,
+                                            from_key, until_key})
+end
+
+-- The client process of the *_iproto tests (see iproto_client.lua), the
+-- requests go through IPROTO from another process, so the client work is
+-- not done in the TX thread of the instance measured.
+local iproto_client
+
+-- Read a JSON line written by the IPROTO client.
+local function iproto_client_read()
+    local line = ''
+    repeat
+        local chunk = iproto_client:read()
+        if chunk == nil or chunk == '' then
+            error('the IPROTO client has exited')
+        end
+        line = line .. chunk
+    until line:sub(-1) == '\n'
+    return json.decode(line)
+end
+
+-- Run the test in the IPROTO client and return the selected row count and
+-- the peak RSS of the client in KB.
+local function iproto_client_call(test, args)
+    iproto_client:write(json.encode({test = test, args = args}) .. '\n')
+    local result = iproto_client_read()
+    return result.rows, result.peak_rss
+end
+
+-- Filter for the IPROTO functions, starts the client if not yet.
+local function iproto_filter()
+    if iproto_client == nil then
+        box.schema.user.grant('guest', 'read', 'space', 's',
+                              {if_not_exists = true})
+        for _, name in ipairs({'procs.select_until_c',
+                               'procs.select_columns_until_c'}) do
+            box.schema.user.grant('guest', 'execute', 'function', name,
+                                  {if_not_exists = true})
+        end
+        -- The arg[-1] is the tarantool executable.
+        local err
+        iproto_client, err = popen.new(
+            {arg[-1], 'iproto_client.lua', iproto_listen},
+            {stdin = popen.opts.PIPE, stdout = popen.opts.PIPE})
+        if iproto_client == nil then
+            log('Failed to start the IPROTO client: ' .. tostring(err) .. '\n')
+            return false
+        end
+        -- Wait until it's connected.
+        iproto_client_read()
+    end
+    return true
+end
+
+-- Select the range by chunks of select_chunk_rows tuples or select_chunk_bytes
+-- bytes in C, each chunk continues after the last tuple of the previous one.
+-- Overheads:
+-- - a lookup each chunk (the iterator is created after the position).
+-- - compare each tuple with the end key.
+-- - copy each tuple into the chunk.
+box.schema.func.create('procs.select_until_c',
+                       {language = 'C', if_not_exists = true})
+local function select_until_c()
+    local selected = 0
+    local after
+    repeat
+        local tuples
+        tuples, after = box.func['procs.select_until_c']:call({
+            s.id, search_index.id, kd_c_parts, from_key, until_key,
+            select_chunk_rows, select_chunk_bytes, after or box.NULL})
+        selected = selected + #tuples
+    until after == nil
+    assert(selected == process_count)
+end
+
+-- Same as select_until_c, but the chunks are requested over IPROTO by the
+-- client process.
+local function select_until_c_iproto()
+    local selected, client_peak_rss = iproto_client_call('select_until_c', {
+        space_id = s.id, index_id = search_index.id, kd_parts = kd_c_parts,
+        from_key = from_key, until_key = until_key,
+        chunk_rows = select_chunk_rows, chunk_bytes = select_chunk_bytes})
+    assert(selected == process_count)
+    return {client_peak_rss = client_peak_rss}
+end
+
+-- Same as process_until_sql, but the rows are requested over IPROTO by the
+-- client process and returned in a single response.
+local function select_until_sql_iproto()
+    local from_value = 1
+    if #from_key ~= 0 then
+        assert(#from_key == 1)
+        from_value = from_key[1]
+    end
+    local selected, client_peak_rss = iproto_client_call('select_until_sql', {
+        from_value = from_value, until_value = until_key[1]})
+    assert(selected == process_count)
+    return {client_peak_rss = client_peak_rss}
+end
+
+-- The fields selected by the select_columns_until_* tests (0-based): all but
+-- the first one, like the analytics queries projecting a few columns.
+local select_columns_fields = {}
+for fieldno = 2, #format do
+    table.insert(select_columns_fields, fieldno - 1)
+end
+
+-- Select the fields of the range as Arrow IPC record batches in C (MemCS)
+-- by chunks of select_columns_batch_limit batches, each chunk continues after
+-- the key of the last row of the previous one. The tuples are not built.
+-- Overheads:
+-- - a lookup to find the amount to select each chunk.
+-- - copy each column batch into the IPC message.
+-- - encode the key of the last row of each chunk.
+box.schema.func.create('procs.select_columns_until_c',
+                       {language = 'C', if_not_exists = true})
+local function select_columns_until_c()
+    local message_count = 0
+    local after
+    repeat
+        -- The messages followed by the key to continue after.
+        local result = {box.func['procs.select_columns_until_c']:call({
+            s.id, search_index.id, kd_c_parts, select_columns_fields,
+            from_key, until_key, batch_size, select_columns_batch_limit,
+            after or box.NULL})}
+        after = table.remove(result)
+        message_count = message_count + #result
+    until after == nil
+    -- The schema and the end of stream at least.
+    assert(message_count >= 2)
+end
+
+-- Same as select_columns_until_c, but requested over IPROTO by the client
+-- process.
+local function select_columns_until_c_iproto()
+    local message_count, client_peak_rss = iproto_client_call(
+        'select_columns_until_c', {
+            space_id = s.id, index_id = search_index.id,
+            kd_parts = kd_c_parts, fields = select_columns_fields,
+            from_key = from_key, until_key = until_key,
+            batch_size = batch_size,
+            batch_limit = select_columns_batch_limit})
+    assert(message_count >= 2)
+    return {client_peak_rss = client_peak_rss}
+end
+
+-- The field aggregated by the aggregate_until_* tests and the aggregates.
+local aggregate_field_name = 'non_unique'
+local aggregate_ops = {'count', 'sum', 'min', 'max', 'avg'}
+local aggregate_fieldno
+for fieldno, field in ipairs(format) do
+    if field.name == aggregate_field_name then
+        aggregate_fieldno = fieldno
+    end
+end
+
+-- The aggregates of the range computed by aggregate_until_lua, the C
+-- functions check their results against them if it's been run.
+local aggregate_expected
+
+local function aggregate_check(op, result)
+    if aggregate_expected == nil then
+        return
+    end
+    local expected = aggregate_expected[op]
+    if op == 'avg' then
+        assert(math.abs(result - expected) <= 1e-9 * math.abs(expected))
+    else
+        assert(result == expected)
+    end
+end
+
+-- Aggregate the field over the range using space:pairs(). Overheads:
+-- - a lookup each step (iterator invalidation).
+-- - compare each tuple with the end key.
+-- - get each field in Lua.
+local function aggregate_until_lua()
+    local count, sum, min, max = 0, 0, nil, nil
+    for _, tuple in search_index:pairs(from_key, {iterator = 'ge'}) do
+        -- Break if the until key reached.
+        if kd:compare_with_key(tuple, until_key) == 0 then
+            break
+        end
+        local value = tuple[aggregate_fieldno]
+        count = count + 1
+        sum = sum + value
+        if min == nil or value < min then
+            min = value
+        end
+        if max == nil or value > max then
+            max = value
+        end
+    end
+    assert(count == process_count)
+    aggregate_expected = {count = count, sum = sum, min = min, max = max,
+                          avg = count ~= 0 and sum / count or nil}
+end
+
+-- Aggregate the field over the range in C. Overheads:
+-- - compare each tuple with the end key.
+-- - decode each field.
+box.schema.func.create('procs.aggregate_until_c',
+                       {language = 'C', if_not_exists = true})
+local function aggregate_until_c(op)
+    return function()
+        aggregate_check(op, box.func['procs.aggregate_until_c']:call({
+            s.id, search_index.id, kd_c_parts, from_key, until_key,
+            aggregate_fieldno - 1, op}))
+    end
+end
+
+-- Aggregate the field over the range by the column batches of the Arrow
+-- stream (MemCS). Overheads:
+-- - a lookup to find the amount to aggregate.
+box.schema.func.create('procs.aggregate_until_c_arrow',
+                       {language = 'C', if_not_exists = true})
+local function aggregate_until_c_arrow(op)
+    return function()
+        aggregate_check(op, box.func['procs.aggregate_until_c_arrow']:call({
+            s.id, search_index.id, from_key, until_key,
+            aggregate_fieldno - 1, op}))
+    end
+end
+
+-- The variants of the C range functions iterating by box_iterator_next_batch,
+-- see the 0002-PoC-box_iterator_next_batch.patch. Overheads are the same as
+-- in the originals, but a virtual call, an iterator position check and a
+-- last tuple ref/unref are done per tuple batch instead of each tuple.
+for _, name in ipairs({'delete_until_c_batched',
+                       'delete_until_c_nocmp_batched',
+                       'update_until_c_batched',
+                       'process_until_c',
+                       'process_range_c'}) do
+    box.schema.func.create('procs.' .. name .. '_next_batch',
+                           {language = 'C', if_not_exists = true})
+end
+
+local function delete_until_c_batched_next_batch()
+    box.func['procs.delete_until_c_batched_next_batch']:call({
+        s.id, search_index.id, write_index.id, kd_c_parts,
+        from_key, until_key, batch_size})
+    assert(s:len() == space_size - process_count)
+end
+
+local function delete_until_c_nocmp_batched_next_batch()
+    box.func['procs.delete_until_c_nocmp_batched_next_batch']:call({
+        s.id, search_index.id, write_index.id, kd_c_parts,
+        from_key, until_key, batch_size})
+    assert(s:len() == space_size - process_count)
+end
+
+local function update_until_c_batched_next_batch()
+    box.func['procs.update_until_c_batched_next_batch']:call({
+        s.id, search_index.id, write_index.id, kd_c_parts,
+        {{'=', 'non_unique', 0}}, from_key, until_key, batch_size})
+end
+
+local function process_until_c_next_batch()
+    box.func['procs.process_until_c_next_batch']:call({
+        s.id, search_index.id, kd_c_parts, from_key, until_key})
+end
+
+-- Compact the search index (0005-PoC-memtx-tree-compact.patch), the
+-- process_until_c_compacted test goes after it.
+local function compact_search_index()
+    search_index:compact()
+end
+
+local function process_range_c_next_batch()
+    box.func['procs.process_range_c_next_batch']:call({
+        s.id, search_index.id, from_key, until_key})
+end
+
+-- Get the stats of the search index tree, nil if not supported.
+local function tree_stat()
+    if box.internal.tree_stat == nil then
+        return nil
+    end
+    local ok, stat = pcall(box.internal.tree_stat, s.id, search_index.id)
+    return ok and stat or nil
+end
+
+local function record_tree_stat(name, time, stat)
+    local file = io.open(tree_stat_path, 'a')
+    file:write(json.encode({test = name, time = time, engine = space_engine,
+                            size = space_size, tree = stat}) .. '\n')
+    file:close()
+end
+
+-- The func may return the stats of a chunked request: {rows = <count>,
+-- chunks = <count>, max_stall = <seconds>}, such a func must manage the
+-- transactions itself (own_transactions). A func not allowed to be called in
+-- a transaction is own_transactions too, but returns nothing. The setup is
+-- called before the func and is not timed. With peak_memory the peak RSS
+-- growth of the instance during the func is shown, and the peak RSS of the
+-- IPROTO client if the func returns {client_peak_rss = <KB>}.
+local function bench(name, func, cleanup, own_transactions, setup,
+                     peak_memory)
     box.once('init', function()
         local function print_table(table, caption)
             log(caption .. ':\n')
@@ -550,11 +1138,6 @@ local function bench(name, func, cleanup)
 
         prepare_for_tests()
 
-        -- Self-written function to print tree stats.
-        -- See the 0001-PoC-tree-stats-in-box.internal.doit.patch.
-        if box.internal.doit ~= nil then
-            box.internal.doit(s.id, search_index.id)
-        end
         print_table(box.slab.info(), 'box.slab.info')
         print_table(box.info.memory(), 'box.info.memory')
 
@@ -563,18 +1146,48 @@ local function bench(name, func, cleanup)
         print_table(box_stat_memtx.index, 'box.stat.memtx.index')
     end)
 
+    if setup ~= nil then
+        setup()
+    end
+
+    -- Taken before the run: the tree the test was performed on.
+    local tree = tree_stat()
     log(name .. ': ')
+    local rss_start
+    if peak_memory then
+        peak_rss_reset()
+        rss_start = rss()
+    end
     local time_start = clock.time()
-    if in_one_transaction then
+    local in_transaction = in_one_transaction and not own_transactions
+    if in_transaction then
         box.begin()
     end
-    func()
-    if in_one_transaction then
+    local stat = func()
+    if in_transaction then
         box.commit()
     end
     local time_end = clock.time()
     local time = time_end - time_start
     log(string.format('%.02f', time))
+    if tree ~= nil then
+        record_tree_stat(name, time, tree)
+    end
+    if own_transactions and stat ~= nil and stat.rows ~= nil then
+        log(string.format(' (%d rows/s, %d chunks, max stall: %.02f ms)',
+                          stat.rows / time, stat.chunks,
+                          stat.max_stall * 1000))
+    end
+    if peak_memory and rss_start ~= nil then
+        -- The server peak is relative to the RSS taken by the dataset.
+        local _, peak_rss = rss()
+        log(string.format(' (peak RSS: server +%d MB',
+                          (peak_rss - rss_start) / 1024))
+        if stat ~= nil and stat.client_peak_rss ~= nil then
+            log(string.format(', client %d MB', stat.client_peak_rss / 1024))
+        end
+        log(')')
+    end
     if cleanup ~= nil then
         cleanup()
     end
@@ -602,6 +1215,14 @@ local tests = {
     { name = 'delete_until_c_batched',
       func = delete_until_c_batched,
       cleanup = refill_space },
+    { name = 'delete_until_c_batched_chunked',
+      func = delete_until_c_batched_chunked,
+      own_transactions = true,
+      cleanup = refill_space },
+    { name = 'delete_until_c_batched_sorted',
+      func = delete_until_c_batched_sorted,
+      filter = search_index_is_not_write_index_filter,
+      cleanup = refill_space },
     { name = 'delete_until_c_nocmp_batched',
       func = delete_until_c_nocmp_batched,
       cleanup = refill_space },
@@ -609,6 +1230,11 @@ local tests = {
       func = delete_until_c_nocmp_arrow,
       filter = space_is_memcs_filter,
       cleanup = refill_space },
+    { name = 'delete_until_c_range_api',
+      func = delete_until_c_range_api,
+      filter = delete_range_c_filter,
+      own_transactions = true,
+      cleanup = refill_space },
     { name = 'update_until_lua_naive',
       func = update_until_lua_naive,
       filter = has_non_unique_field_filter,
@@ -629,6 +1255,16 @@ local tests = {
       func = update_until_c_batched,
       filter = has_non_unique_field_filter,
       cleanup = refill_space },
+    { name = 'update_until_c_batched_chunked',
+      func = update_until_c_batched_chunked,
+      filter = has_non_unique_field_filter,
+      own_transactions = true,
+      cleanup = refill_space },
+    { name = 'bulk_update_c',
+      func = bulk_update_c,
+      setup = bulk_update_setup,
+      filter = has_non_unique_field_filter,
+      cleanup = refill_space },
     { name = 'process_until_lua',
       func = process_until_lua },
     { name = 'process_until_sql',
@@ -636,14 +1272,127 @@ local tests = {
       filter = delete_process_until_sql_filter },
     { name = 'process_until_c',
       func = process_until_c },
+    { name = 'process_range_c',
+      func = process_range_c,
+      filter = space_is_memtx_filter },
+    { name = 'process_until_c_noref',
+      func = process_until_c_noref,
+      filter = has_iterator_noref_filter },
+    { name = 'process_until_c_compact',
+      func = compact_search_index,
+      filter = space_is_memtx_filter,
+      own_transactions = true },
+    { name = 'process_until_c_compacted',
+      func = process_until_c,
+      filter = space_is_memtx_filter },
 }
 
+-- The batch iterator API variants.
+for _, test in ipairs({
+    { name = 'delete_until_c_batched_next_batch',
+      func = delete_until_c_batched_next_batch,
+      cleanup = refill_space },
+    { name = 'delete_until_c_nocmp_batched_next_batch',
+      func = delete_until_c_nocmp_batched_next_batch,
+      cleanup = refill_space },
+    { name = 'update_until_c_batched_next_batch',
+      func = update_until_c_batched_next_batch,
+      filter = has_non_unique_field_filter,
+      cleanup = refill_space },
+    { name = 'process_until_c_next_batch',
+      func = process_until_c_next_batch },
+    { name = 'process_range_c_next_batch',
+      func = process_range_c_next_batch,
+      filter = space_is_memtx_filter },
+}) do
+    local filter = test.filter
+    test.filter = function()
+        return has_next_batch_filter() and (filter == nil or filter())
+    end
+    table.insert(tests, test)
+end
+
+-- The chunked select.
+table.insert(tests, {
+    name = 'select_until_c',
+    func = select_until_c,
+    peak_memory = true })
+table.insert(tests, {
+    name = 'select_until_c_iproto',
+    func = select_until_c_iproto,
+    filter = iproto_filter,
+    own_transactions = true,
+    peak_memory = true })
+table.insert(tests, {
+    name = 'select_until_sql_iproto',
+    func = select_until_sql_iproto,
+    filter = function()
+        return delete_process_until_sql_filter() and iproto_filter()
+    end,
+    own_transactions = true,
+    peak_memory = true })
+
+-- The column-projected select.
+table.insert(tests, {
+    name = 'select_columns_until_c',
+    func = select_columns_until_c,
+    filter = space_is_memcs_filter,
+    peak_memory = true })
+table.insert(tests, {
+    name = 'select_columns_until_c_iproto',
+    func = select_columns_until_c_iproto,
+    filter = function()
+        return space_is_memcs_filter() and iproto_filter()
+    end,
+    own_transactions = true,
+    peak_memory = true })
+
+-- The aggregates.
+local function has_aggregate_field_filter()
+    return aggregate_fieldno ~= nil
+end
+table.insert(tests, {
+    name = 'aggregate_until_lua',
+    func = aggregate_until_lua,
+    filter = has_aggregate_field_filter })
+for _, op in ipairs(aggregate_ops) do
+    table.insert(tests, {
+        name = 'aggregate_until_c_' .. op,
+        func = aggregate_until_c(op),
+        filter = has_aggregate_field_filter })
+end
+for _, op in ipairs(aggregate_ops) do
+    table.insert(tests, {
+        name = 'aggregate_until_c_arrow_' .. op,
+        func = aggregate_until_c_arrow(op),
+        filter = function()
+            return has_aggregate_field_filter() and space_is_memcs_filter()
+        end })
+end
+
+-- The lookahead sweep.
+for _, lookahead in ipairs(lookahead_sizes) do
+    table.insert(tests, {
+        name = 'delete_until_c_batched_lookahead_' .. lookahead,
+        func = delete_until_c_batched_lookahead(lookahead),
+        cleanup = refill_space,
+        filter = space_is_memtx_filter })
+end
+for _, lookahead in ipairs(lookahead_sizes) do
+    table.insert(tests, {
+        name = 'process_until_c_lookahead_' .. lookahead,
+        func = process_until_c_lookahead(lookahead),
+        filter = space_is_memtx_filter })
+end
+
 local function run_tests(repetition_count)
     for _, test in ipairs(tests) do
         if arg[1] == nil or string.find(test.name, arg[1]) then
             if test.filter == nil or test.filter() then
                 for i = 1, repetition_count do
-                    bench(test.name, test.func, test.cleanup)
+                    bench(test.name, test.func, test.cleanup,
+                          test.own_transactions, test.setup,
+                          test.peak_memory)
                 end
             end
         end
@@ -673,6 +1422,10 @@ log('Until offset: ' .. until_key_offset .. '\n')
 log('Search part count: ' .. until_key_part_count .. '\n')
 log('Write index: ' .. write_index_name .. '\n')
 log('Batch size: ' .. batch_size .. '\n')
+log('Commit every (batches): ' .. commit_every .. '\n')
+log('Select chunk: ' .. select_chunk_rows .. ' rows, ' ..
+    select_chunk_bytes .. ' bytes\n')
+log('Select columns chunk (batches): ' .. select_columns_batch_limit .. '\n')
 log('\n')
 log('WAL mode: ' .. wal_mode .. '\n')
 log('In one transaction: ' .. tostring(in_one_transaction) .. '\n')
@@ -687,6 +1440,16 @@ end
 log('\nTesting...\n')
 run_tests(repetition_count)
 
-log('\nDeleted|updated|processed count (per test): ' .. process_count .. '\n\n')
+log('\nDeleted|updated|processed count (per test): ' .. process_count .. '\n')
+
+-- Make sure the C functions don't rebuild the key definitions each call.
+box.schema.func.create('procs.key_def_cache_stat',
+                       {language = 'C', if_not_exists = true})
+local key_def_cache_stat = box.func['procs.key_def_cache_stat']:call()
+log('Key definition cache: ' ..
+    'size: ' .. key_def_cache_stat.size .. ', ' ..
+    'hits: ' .. key_def_cache_stat.hits .. ', ' ..
+    'misses: ' .. key_def_cache_stat.misses .. ', ' ..
+    'evictions: ' .. key_def_cache_stat.evictions .. '\n\n')
 
 os.exit()
@@ -0,0 +1,77 @@
+-- The client of the *_iproto tests of init.lua. It's run as a separate
+-- process, so the client side of the requests doesn't share the TX thread
+-- with the server and doesn't skew its numbers.
+--
+-- Usage: tarantool iproto_client.lua <URI>
+--
+-- Connects to the URI and writes an empty JSON line once ready. Then reads
+-- a request per line from stdin: {"test": <name>, "args": {...}}, runs the
+-- test and writes its result as a JSON line: {"rows": <selected row count>,
+-- "peak_rss": <peak RSS of the process in KB>}.
+
+local json = require('json')
+local net_box = require('net.box')
+
+local conn = net_box.connect(arg[1])
+assert(conn:is_connected(), conn.error)
+
+-- The peak resident set size of the process in KB.
+local function peak_rss()
+    local file = io.open('/proc/self/status')
+    if file == nil then
+        return nil
+    end
+    local status = file:read('*a')
+    file:close()
+    return tonumber(status:match('VmHWM:%s*(%d+) kB'))
+end
+
+local tests = {}
+
+-- Select the range chunk by chunk, see select_until_c in init.lua.
+function tests.select_until_c(args)
+    local selected = 0
+    local after
+    repeat
+        local tuples
+        tuples, after = conn:call('procs.select_until_c', {
+            args.space_id, args.index_id, args.kd_parts, args.from_key,
+            args.until_key, args.chunk_rows, args.chunk_bytes,
+            after or box.NULL})
+        selected = selected + #tuples
+    until after == nil
+    return selected
+end
+
+-- Select the range in a single SQL response.
+function tests.select_until_sql(args)
+    local result = conn:execute(
+        'SELECT * FROM s WHERE id >= ? AND id < ?;',
+        {args.from_value, args.until_value})
+    return #result.rows
+end
+
+-- Select the range columns as Arrow IPC messages chunk by chunk, see
+-- select_columns_until_c in init.lua. Returns the message count.
+function tests.select_columns_until_c(args)
+    local message_count = 0
+    local after
+    repeat
+        local result = {conn:call('procs.select_columns_until_c', {
+            args.space_id, args.index_id, args.kd_parts, args.fields,
+            args.from_key, args.until_key, args.batch_size,
+            args.batch_limit, after or box.NULL})}
+        after = table.remove(result)
+        message_count = message_count + #result
+    until after == nil
+    return message_count
+end
+
+io.stdout:write('{}\n')
+io.stdout:flush()
+for line in io.lines() do
+    local request = json.decode(line)
+    local rows = tests[request.test](request.args)
+    io.stdout:write(json.encode({rows = rows, peak_rss = peak_rss()}) .. '\n')
+    io.stdout:flush()
+end
@@ -0,0 +1,163 @@
+#pragma once
+
+/*
+ * Single pass msgpack encoder of single-part unsigned keys ([uint]) taken
+ * from an uint64 column. Each value is classified into the msgpack uint
+ * width class (fixint, uint8, uint16, uint32, uint64), the key offsets are
+ * prefix-summed from the classes and the keys are scattered to the output
+ * by branchless stores. The classification is vectorized if AVX2 is there.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/* Maximum size of an encoded key: the array header and an uint64. */
+#define MP_UINT64_KEY_SIZE_MAX 10
+
+/* The encoder may write this much garbage past the last key end. */
+#define MP_UINT64_KEYS_SLACK 16
+
+/* Size of the keys output buffer required for the count keys. */
+static inline size_t
+mp_uint64_keys_size_max(int count)
+{
+	return (size_t)count * MP_UINT64_KEY_SIZE_MAX + MP_UINT64_KEYS_SLACK;
+}
+
+/*
+ * Write the encoded value of the given encoded size (mp_sizeof_uint). The
+ * payload is always written as 8 bytes, so up to 8 bytes past the value
+ * end are overwritten.
+ */
+static inline char *
+mp_uint64_store(char *data, uint64_t value, unsigned size)
+{
+	static const uint8_t tags[] = {
+		0, 0, 0xcc, 0xcd, 0, 0xce, 0, 0, 0, 0xcf,
+	};
+	unsigned payload_size = size - 1;
+	uint64_t payload = __builtin_bswap64(
+		value << ((64 - 8 * payload_size) & 63));
+	data[0] = size == 1 ? (uint8_t)value : tags[size];
+	memcpy(data + 1, &payload, sizeof(payload));
+	return data + size;
+}
+
+static inline char *
+mp_encode_uint64_keys_scalar(const uint64_t *values, int count,
+			     char **bounds, char *data)
+{
+	for (int i = 0; i < count; i++) {
+		uint64_t value = values[i];
+		unsigned size = 1 + (value > 0x7f) + (value > 0xff) +
+				2 * (value > 0xffff) +
+				4 * (value > 0xffffffff);
+		bounds[i] = data;
+		*data = (char)0x91;
+		data = mp_uint64_store(data + 1, value, size);
+	}
+	bounds[count] = data;
+	return data;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+static char *
+mp_encode_uint64_keys_avx2(const uint64_t *values, int count,
+			   char **bounds, char *data)
+{
+	/* No unsigned 64-bit compare in AVX2: compare with the sign flipped. */
+	const __m256i sign = _mm256_set1_epi64x(INT64_MIN);
+	const __m256i max_fixint = _mm256_set1_epi64x(0x7f ^ INT64_MIN);
+	const __m256i max_u8 = _mm256_set1_epi64x(0xff ^ INT64_MIN);
+	const __m256i max_u16 = _mm256_set1_epi64x(0xffff ^ INT64_MIN);
+	const __m256i max_u32 = _mm256_set1_epi64x(0xffffffff ^ INT64_MIN);
+	const __m256i two = _mm256_set1_epi64x(2);
+	const __m256i head_u8 = _mm256_set1_epi64x(0xcc91);
+	const __m256i head_mask = _mm256_set1_epi64x(0xffff);
+	const __m256i array_header = _mm256_set1_epi64x(0x91);
+	const __m256i bits_in_u64 = _mm256_set1_epi64x(64);
+	const __m256i bswap64 = _mm256_setr_epi8(
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+		7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)&values[i]);
+		__m256i biased = _mm256_xor_si256(v, sign);
+
+		/* Classify: the masks are -1 if greater, so subtract them. */
+		__m256i gt_fixint = _mm256_cmpgt_epi64(biased, max_fixint);
+		__m256i gt_u8 = _mm256_cmpgt_epi64(biased, max_u8);
+		__m256i gt_u16 = _mm256_cmpgt_epi64(biased, max_u16);
+		__m256i gt_u32 = _mm256_cmpgt_epi64(biased, max_u32);
+		__m256i payload_size = _mm256_sub_epi64(
+			_mm256_setzero_si256(), gt_fixint);
+		payload_size = _mm256_sub_epi64(payload_size, gt_u8);
+		payload_size = _mm256_sub_epi64(
+			payload_size, _mm256_slli_epi64(gt_u16, 1));
+		payload_size = _mm256_sub_epi64(
+			payload_size, _mm256_slli_epi64(gt_u32, 2));
+
+		/* Head: the array header and 0xcc..0xcf or the fixint. */
+		__m256i head = _mm256_sub_epi64(
+			head_u8, _mm256_slli_epi64(gt_u8, 8));
+		head = _mm256_sub_epi64(head, _mm256_slli_epi64(gt_u16, 8));
+		head = _mm256_sub_epi64(head, _mm256_slli_epi64(gt_u32, 8));
+		head = _mm256_and_si256(head, head_mask);
+		__m256i fixint_head = _mm256_or_si256(
+			array_header, _mm256_slli_epi64(v, 8));
+		head = _mm256_blendv_epi8(fixint_head, head, gt_fixint);
+
+		/*
+		 * Payload: the big-endian value bytes. The shift is 64 for
+		 * fixint, vpsllvq gives zero for such shifts.
+		 */
+		__m256i shift = _mm256_sub_epi64(
+			bits_in_u64, _mm256_slli_epi64(payload_size, 3));
+		__m256i payload = _mm256_shuffle_epi8(
+			_mm256_sllv_epi64(v, shift), bswap64);
+
+		/* Combine into the two words stored per key. */
+		__m256i lo = _mm256_or_si256(head,
+					     _mm256_slli_epi64(payload, 16));
+		__m256i hi = _mm256_srli_epi64(payload, 48);
+		__m256i size = _mm256_add_epi64(payload_size, two);
+
+		uint64_t los[4], his[4], sizes[4];
+		_mm256_storeu_si256((__m256i *)los, lo);
+		_mm256_storeu_si256((__m256i *)his, hi);
+		_mm256_storeu_si256((__m256i *)sizes, size);
+		for (int j = 0; j < 4; j++) {
+			bounds[i + j] = data;
+			memcpy(data, &los[j], sizeof(los[j]));
+			memcpy(data + sizeof(los[j]), &his[j], sizeof(his[j]));
+			data += sizes[j];
+		}
+	}
+	return mp_encode_uint64_keys_scalar(values + i, count - i,
+					    bounds + i, data);
+}
+
+#endif /* defined(__x86_64__) */
+
+/*
+ * Encode count single-part keys into data which must have at least
+ * mp_uint64_keys_size_max(count) bytes. The key number i is located at
+ * [bounds[i], bounds[i + 1]), so bounds must have count + 1 entries.
+ * Returns the end of the last key.
+ */
+static inline char *
+mp_encode_uint64_keys(const uint64_t *values, int count,
+		      char **bounds, char *data)
+{
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2"))
+		return mp_encode_uint64_keys_avx2(values, count, bounds, data);
+#endif
+	return mp_encode_uint64_keys_scalar(values, count, bounds, data);
+}
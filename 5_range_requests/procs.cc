@@ -2,12 +2,24 @@
 #include "msgpuck.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <assert.h>
+#include <math.h>
+
+#include <algorithm>
+#include <type_traits>
 
 #include "arrow/abi.h"
 
+#include "mp_uint64_keys.h"
+#include "arrow_ipc.h"
+
 #define lengthof(array) (sizeof (array) / sizeof ((array)[0]))
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+/* Maximum count of parts in an index key passed to the procedures. */
+#define INDEX_PARTS_MAX 8
 
 #define ERROR(...) box_error_set(__FILE__, __LINE__, ER_PROC_C, __VA_ARGS__)
 
@@ -100,8 +112,8 @@ args_parse_index_parts(const char **args, uint32_t **fields,
 	if (parts_len % 2 != 0)
 		return ERROR("non-even c_parts");
 	*part_count = parts_len / 2;
-	if (*part_count > 8)
-		return ERROR("more than 8 parts?");
+	if (*part_count > INDEX_PARTS_MAX)
+		return ERROR("more than %d parts?", INDEX_PARTS_MAX);
 	*fields = (uint32_t *)malloc(sizeof(**fields) * *part_count);
 	if (*fields == NULL)
 		return ERROR("can't allocate fields array");
@@ -128,159 +140,566 @@ args_parse_index_parts(const char **args, uint32_t **fields,
 	return 0;
 }
 
+/** Index parts parsed once and cached between the calls. */
+struct key_def_cache_entry {
+	/** The encoded parts array the entry is created from. */
+	char *parts;
+	/** Size of the encoded parts array. */
+	size_t parts_size;
+	/** Field numbers of the parts. */
+	uint32_t *fields;
+	/** Field types of the parts. */
+	uint32_t *types;
+	/** Count of the parts. */
+	uint32_t part_count;
+	/** The key definition built of the parts. */
+	box_key_def_t *kd;
+	/** Value of key_def_cache_clock on the last entry access. */
+	uint64_t last_used;
+	/**
+	 * The count of references: one of the cache and one of each call
+	 * using the entry across yields, see key_def_cache_entry_ref.
+	 */
+	uint32_t refs;
+};
+
+/** Count of the key definitions kept in the cache. */
+#define KEY_DEF_CACHE_SIZE 16
+
+/* A procedure may use a couple of entries at once, see below. */
+static_assert(KEY_DEF_CACHE_SIZE >= 2, "Too small key_def cache");
+
+static struct key_def_cache_entry *key_def_cache[KEY_DEF_CACHE_SIZE];
+static uint64_t key_def_cache_clock;
+static uint64_t key_def_cache_hits;
+static uint64_t key_def_cache_misses;
+static uint64_t key_def_cache_evictions;
+
+static void
+key_def_cache_entry_delete(struct key_def_cache_entry *entry)
+{
+	if (entry->kd != NULL)
+		box_key_def_delete(entry->kd);
+	free(entry->types);
+	free(entry->fields);
+	free(entry->parts);
+	free(entry);
+}
+
+/*
+ * Keep the entry alive after its eviction. A call yielding (committing by
+ * chunks) must reference the entries it uses: other calls may evict them
+ * meanwhile.
+ */
+static void
+key_def_cache_entry_ref(struct key_def_cache_entry *entry)
+{
+	entry->refs++;
+}
+
+static void
+key_def_cache_entry_unref(struct key_def_cache_entry *entry)
+{
+	assert(entry->refs > 0);
+	if (--entry->refs == 0)
+		key_def_cache_entry_delete(entry);
+}
+
+/*
+ * Array: {fieldno, type, ...}. The returned entry is owned by the cache,
+ * the least recently used entry is evicted on miss, so the entries got
+ * within a single procedure call remain valid until it returns or yields
+ * (see key_def_cache_entry_ref).
+ */
 static int
-args_parse_key_def(const char **args, struct key_def **kd)
+args_parse_index_parts_cached(const char **args,
+			      struct key_def_cache_entry **result)
 {
-	uint32_t *fields, *types, part_count;
-	if (args_parse_index_parts(args, &fields, &types, &part_count) != 0)
-		return -1;
-	auto guard = make_scoped_guard([fields, types]() {
-		free(fields);
-		free(types);
+	if (mp_typeof(**args) != MP_ARRAY)
+		return ERROR("index parts not array");
+	const char *parts = *args;
+	mp_next(args); /* Skip the parts. */
+	size_t parts_size = *args - parts;
+
+	/* Lookup the cache and find the least recently used slot. */
+	unsigned victim = 0;
+	uint64_t victim_last_used = UINT64_MAX;
+	for (unsigned i = 0; i < lengthof(key_def_cache); i++) {
+		struct key_def_cache_entry *entry = key_def_cache[i];
+		if (entry != NULL && entry->parts_size == parts_size &&
+		    memcmp(entry->parts, parts, parts_size) == 0) {
+			entry->last_used = ++key_def_cache_clock;
+			key_def_cache_hits++;
+			*result = entry;
+			return 0;
+		}
+		uint64_t last_used = entry != NULL ? entry->last_used : 0;
+		if (last_used < victim_last_used) {
+			victim = i;
+			victim_last_used = last_used;
+		}
+	}
+	key_def_cache_misses++;
+
+	/* Create a new entry. */
+	struct key_def_cache_entry *entry = (struct key_def_cache_entry *)
+		calloc(1, sizeof(*entry));
+	if (entry == NULL)
+		return ERROR("can't allocate a key_def cache entry");
+	auto entry_guard = make_scoped_guard([entry]() {
+		key_def_cache_entry_delete(entry);
 	});
-	*kd = box_key_def_new(fields, types, part_count);
-	if (*kd == NULL)
+	const char *parts_it = parts;
+	if (args_parse_index_parts(&parts_it, &entry->fields, &entry->types,
+				   &entry->part_count) != 0)
+		return -1;
+	entry->kd = box_key_def_new(entry->fields, entry->types,
+				    entry->part_count);
+	if (entry->kd == NULL)
 		return ERROR("couldn't create a key definition");
+	entry->parts = (char *)malloc(parts_size);
+	if (entry->parts == NULL)
+		return ERROR("can't allocate a key_def cache entry");
+	memcpy(entry->parts, parts, parts_size);
+	entry->parts_size = parts_size;
+	entry->last_used = ++key_def_cache_clock;
+	entry->refs = 1;
+
+	/* Replace the least recently used one with it. */
+	if (key_def_cache[victim] != NULL) {
+		key_def_cache_evictions++;
+		key_def_cache_entry_unref(key_def_cache[victim]);
+	}
+	key_def_cache[victim] = entry;
+	entry_guard.is_active = false;
+	*result = entry;
 	return 0;
 }
 
-extern "C" int
-delete_until_c_naive(box_function_ctx_t *ctx,
-		     const char *args, const char *args_end)
+/* The key_def is owned by the cache and must not be deleted. */
+static int
+args_parse_key_def(const char **args, box_key_def_t **kd)
 {
-	/* Parse the arguments. */
-	if (mp_typeof(*args) != MP_ARRAY)
-		return ERROR("args not array");
-	uint32_t arg_count = mp_decode_array(&args);
-	if (arg_count != 6)
-		return ERROR("invalid argument count: %d", arg_count);
-
-	/* Space ID. */
-	if (mp_typeof(*args) != MP_UINT)
-		return ERROR("space ID not uint");
-	uint32_t space_id = mp_decode_uint(&args);
+	struct key_def_cache_entry *entry;
+	if (args_parse_index_parts_cached(args, &entry) != 0)
+		return -1;
+	*kd = entry->kd;
+	return 0;
+}
 
-	/* Search index ID. */
-	if (mp_typeof(*args) != MP_UINT)
-		return ERROR("index ID not uint");
-	uint32_t index_id = mp_decode_uint(&args);
+/* Maximum count of key parts the comparators are specialized for. */
+#define KEY_COMPARATOR_PARTS_MAX 2
 
-	/* Write index ID. */
-	if (mp_typeof(*args) != MP_UINT)
-		return ERROR("write index ID not uint");
-	uint32_t write_index_id = mp_decode_uint(&args);
+/* A key part decoded once for the specialized comparators. */
+union key_comparator_part {
+	uint64_t u;
+	struct {
+		const char *data;
+		uint32_t len;
+	} str;
+};
 
-	/* Search index key_def. */
+/*
+ * Comparator of the tuples with a key. The comparison function is chosen
+ * once for the key: a compare_until instantiation for the key parts types
+ * or compare_until_generic.
+ */
+struct key_comparator {
+	int (*compare)(const struct key_comparator *cmp, box_tuple_t *tuple);
+	/* The tuple fields of the key parts and the parts decoded. */
+	uint32_t fields[KEY_COMPARATOR_PARTS_MAX];
+	union key_comparator_part parts[KEY_COMPARATOR_PARTS_MAX];
+	/* The key and its definition for the generic comparison. */
+	const char *key;
 	box_key_def_t *kd;
-	if (args_parse_key_def(&args, &kd) != 0)
-		return -1;
-	auto kd_guard = make_scoped_guard([kd]() { box_key_def_delete(kd); });
+};
 
-	/* The from key. */
-	if (mp_typeof(*args) != MP_ARRAY)
-		return ERROR("key is not array");
-	const char *from_key = args;
-	mp_next(&args); /* Skip the key. */
-	const char *from_key_end = args;
+/* An unsigned key part, the tuple field is MP_UINT in such an index. */
+struct Unsigned {
+	static int
+	decode(const char **key, union key_comparator_part *part)
+	{
+		if (mp_typeof(**key) != MP_UINT)
+			return -1;
+		part->u = mp_decode_uint(key);
+		return 0;
+	}
 
-	/* The until key. */
-	if (mp_typeof(*args) != MP_ARRAY)
-		return ERROR("key is not array");
-	const char *until_key = args;
-	mp_next(&args); /* Skip the key. */
+	static inline int
+	compare(const char *field, const union key_comparator_part *part)
+	{
+		uint64_t value = mp_decode_uint(&field);
+		return value < part->u ? -1 : value > part->u;
+	}
+};
 
-	/* That's it. */
-	if (args != args_end)
-		return ERROR("bigger input than expected");
+/* A string key part without collation: compared bytewise. */
+struct String {
+	static int
+	decode(const char **key, union key_comparator_part *part)
+	{
+		if (mp_typeof(**key) != MP_STR)
+			return -1;
+		part->str.data = mp_decode_str(key, &part->str.len);
+		return 0;
+	}
 
-	/* Create the search index iterator. */
-	box_iterator_t *it = box_index_iterator(space_id, index_id, ITER_GE,
-						from_key, from_key_end);
-	if (it == NULL)
-		return ERROR("couldn't create an iterator");
-	auto it_guard = make_scoped_guard([it]() { box_iterator_free(it); });
+	static inline int
+	compare(const char *field, const union key_comparator_part *part)
+	{
+		uint32_t len;
+		const char *data = mp_decode_str(&field, &len);
+		int rc = memcmp(data, part->str.data, MIN(len, part->str.len));
+		if (rc != 0)
+			return rc;
+		return len < part->str.len ? -1 : len > part->str.len;
+	}
+};
 
-	/* Iterate over the space and delete tuples. */
-	box_tuple_t *tuple;
-	for (;;) {
-		/* Savepoint memory for the extracted key. */
-		size_t region_svp = box_region_used();
-		auto region_guard = make_scoped_guard([region_svp]() {
-			box_region_truncate(region_svp);
-		});
+template <typename Part1>
+static int
+compare_until(const struct key_comparator *cmp, box_tuple_t *tuple)
+{
+	return Part1::compare(box_tuple_field(tuple, cmp->fields[0]),
+			      &cmp->parts[0]);
+}
 
-		/* Get the next tuple. */
-		if (box_iterator_next(it, &tuple) != 0)
-			return ERROR("couldn't advance the iterator");
-		if (tuple == NULL)
-			return ERROR("unexpected end of space");
+template <typename Part1, typename Part2>
+static int
+compare_until(const struct key_comparator *cmp, box_tuple_t *tuple)
+{
+	int rc = Part1::compare(box_tuple_field(tuple, cmp->fields[0]),
+				&cmp->parts[0]);
+	if (rc != 0)
+		return rc;
+	return Part2::compare(box_tuple_field(tuple, cmp->fields[1]),
+			      &cmp->parts[1]);
+}
 
-		/* The until key reached - stop deletion.*/
-		if (box_tuple_compare_with_key(tuple, until_key, kd) == 0)
-			break;
+static int
+compare_until_generic(const struct key_comparator *cmp, box_tuple_t *tuple)
+{
+	return box_tuple_compare_with_key(tuple, cmp->key, cmp->kd);
+}
 
-		/* Delete the tuple. */
-		uint32_t key_size;
-		char *key = box_tuple_extract_key(tuple, space_id,
-						  write_index_id, &key_size);
-		if (key == NULL)
-			return ERROR("couldn't extract key from tuple");
-		if (box_delete(space_id, write_index_id, key,
-			       key + key_size, &tuple) != 0) {
-			return ERROR("couldn't delete a tuple");
-		}
+template <typename Part1>
+static void
+key_comparator_choose(struct key_comparator *cmp, uint32_t part_count,
+		      uint32_t part2_type)
+{
+	if (part_count == 1)
+		cmp->compare = compare_until<Part1>;
+	else if (part2_type == FIELD_TYPE_UNSIGNED)
+		cmp->compare = compare_until<Part1, Unsigned>;
+	else
+		cmp->compare = compare_until<Part1, String>;
+}
+
+/*
+ * Create a comparator of tuples with the key of the index parts. The
+ * common schemas (up to KEY_COMPARATOR_PARTS_MAX unsigned or string key
+ * parts) get a specialized comparator decoding the key once and the tuple
+ * fields raw, others fall back to box_tuple_compare_with_key.
+ */
+static void
+key_comparator_create(struct key_comparator *cmp,
+		      const struct key_def_cache_entry *parts,
+		      const char *key)
+{
+	cmp->compare = compare_until_generic;
+	cmp->key = key;
+	cmp->kd = parts->kd;
+	uint32_t part_count = mp_decode_array(&key);
+	if (part_count == 0 || part_count > KEY_COMPARATOR_PARTS_MAX ||
+	    part_count > parts->part_count)
+		return;
+	for (uint32_t i = 0; i < part_count; i++) {
+		cmp->fields[i] = parts->fields[i];
+		int rc;
+		if (parts->types[i] == FIELD_TYPE_UNSIGNED)
+			rc = Unsigned::decode(&key, &cmp->parts[i]);
+		else if (parts->types[i] == FIELD_TYPE_STRING)
+			rc = String::decode(&key, &cmp->parts[i]);
+		else
+			rc = -1;
+		if (rc != 0)
+			return;
+	}
+	uint32_t part2_type = part_count > 1 ? parts->types[1] : 0;
+	if (parts->types[0] == FIELD_TYPE_UNSIGNED)
+		key_comparator_choose<Unsigned>(cmp, part_count, part2_type);
+	else
+		key_comparator_choose<String>(cmp, part_count, part2_type);
+}
+
+/* Compare the tuple with the comparator key, like tuple_compare_with_key. */
+static inline int
+key_comparator_compare(const struct key_comparator *cmp, box_tuple_t *tuple)
+{
+	return cmp->compare(cmp, tuple);
+}
+
+/* The fields of an index key to extract from the tuples. */
+struct key_extractor {
+	uint32_t fields[INDEX_PARTS_MAX];
+	uint32_t part_count;
+};
+
+/* Get the key fields of the index, JSON path parts are not supported. */
+static int
+key_extractor_create(struct key_extractor *extractor, uint32_t space_id,
+		     uint32_t index_id)
+{
+	const box_key_def_t *kd = box_index_key_def(space_id, index_id);
+	if (kd == NULL)
+		return ERROR("couldn't get the index key definition");
+	size_t region_svp = box_region_used();
+	auto region_guard = make_scoped_guard([region_svp]() {
+		box_region_truncate(region_svp);
+	});
+	uint32_t part_count;
+	box_key_part_def_t *parts = box_key_def_dump_parts(kd, &part_count);
+	if (parts == NULL)
+		return ERROR("couldn't dump the index key parts");
+	if (part_count > INDEX_PARTS_MAX)
+		return ERROR("more than %d parts?", INDEX_PARTS_MAX);
+	for (uint32_t i = 0; i < part_count; i++) {
+		if (parts[i].path != NULL)
+			return ERROR("JSON path key parts are not supported");
+		extractor->fields[i] = parts[i].fieldno;
 	}
+	extractor->part_count = part_count;
 	return 0;
 }
 
+/*
+ * Growable buffer of the keys extracted from tuples. Unlike the keys of
+ * box_tuple_extract_key it's not on the region, so it's reused across the
+ * tuples and batches of a call without a region savepoint per tuple.
+ */
+struct key_buf {
+	/* The keys data. */
+	char *data;
+	size_t size;
+	size_t capacity;
+	/* The key end offsets: the key i is [ends[i - 1], ends[i]). */
+	size_t *ends;
+	uint32_t count;
+	uint32_t ends_capacity;
+};
+
+static void
+key_buf_destroy(struct key_buf *buf)
+{
+	free(buf->ends);
+	free(buf->data);
+}
+
+/* Drop the keys, the memory is kept for the next ones. */
+static inline void
+key_buf_reset(struct key_buf *buf)
+{
+	buf->size = 0;
+	buf->count = 0;
+}
+
 static int
-arrow_array_row_to_mp(struct ArrowArray *array, int row_i, uint32_t *types,
-		      char *data, ptrdiff_t *data_sz)
+key_buf_reserve(struct key_buf *buf, size_t size)
 {
-	for (int col_i = 0; col_i < array->n_children; col_i++) {
-		struct ArrowArray *column = array->children[col_i];
-		uint64_t *u64_values = (uint64_t *)column->buffers[1];
-		switch (types[col_i]) {
-		case FIELD_TYPE_UNSIGNED:
-			data = mp_encode_uint_safe(data, data_sz,
-						   u64_values[row_i]);
-			break;
-		default:
-			return ERROR("Unknown field type: %s",
-				     field_type_strs[types[col_i]]);
+	if (buf->size + size > buf->capacity) {
+		size_t capacity = MAX(buf->capacity * 2, buf->size + size);
+		char *data = (char *)realloc(buf->data, capacity);
+		if (data == NULL)
+			return ERROR("can't allocate the key buffer");
+		buf->data = data;
+		buf->capacity = capacity;
+	}
+	if (buf->count == buf->ends_capacity) {
+		uint32_t capacity = MAX(buf->ends_capacity * 2, 16);
+		size_t *ends = (size_t *)realloc(buf->ends,
+						 capacity * sizeof(*ends));
+		if (ends == NULL)
+			return ERROR("can't allocate the key buffer");
+		buf->ends = ends;
+		buf->ends_capacity = capacity;
+	}
+	return 0;
+}
+
+/* Extract the key from the tuple and append it to the buffer. */
+static inline int
+key_buf_add(struct key_buf *buf, const struct key_extractor *extractor,
+	    box_tuple_t *tuple)
+{
+	const char *fields[INDEX_PARTS_MAX];
+	const char *field_ends[INDEX_PARTS_MAX];
+	size_t size = mp_sizeof_array(extractor->part_count);
+	for (uint32_t i = 0; i < extractor->part_count; i++) {
+		const char *field = box_tuple_field(tuple,
+						    extractor->fields[i]);
+		const char *field_end = field;
+		if (field != NULL)
+			mp_next(&field_end);
+		fields[i] = field;
+		field_ends[i] = field_end;
+		/* An absent optional field is nil in the key. */
+		size += field != NULL ? field_end - field : mp_sizeof_nil();
+	}
+	if (key_buf_reserve(buf, size) != 0)
+		return -1;
+	char *data = mp_encode_array(buf->data + buf->size,
+				     extractor->part_count);
+	for (uint32_t i = 0; i < extractor->part_count; i++) {
+		if (fields[i] == NULL) {
+			data = mp_encode_nil(data);
+			continue;
 		}
+		memcpy(data, fields[i], field_ends[i] - fields[i]);
+		data += field_ends[i] - fields[i];
 	}
+	buf->size = data - buf->data;
+	buf->ends[buf->count++] = buf->size;
 	return 0;
 }
 
+/* Append the key given as a msgpack array or as a single part value. */
 static int
-arrow_array_transpose(struct ArrowArray *array, uint32_t *types,
-		      int key_count, char **keys)
+key_buf_add_key(struct key_buf *buf, const char *key, const char *key_end)
 {
-	for (int row_i = 0; row_i < key_count; row_i++) {
-		ptrdiff_t key_len = 0;
-		if (arrow_array_row_to_mp(array, row_i, types, NULL, &key_len))
-			return -1;
-		keys[row_i] = (char *)malloc(
-			-key_len + mp_sizeof_array(array->n_children));
-		if (keys[row_i] == NULL)
-			return ERROR("can't allocate a key");
-		char *data = mp_encode_array(keys[row_i], array->n_children);
-		if (arrow_array_row_to_mp(array, row_i, types, data, NULL) != 0)
+	bool is_array = mp_typeof(*key) == MP_ARRAY;
+	size_t size = (key_end - key) + (is_array ? 0 : mp_sizeof_array(1));
+	if (key_buf_reserve(buf, size) != 0)
+		return -1;
+	char *data = buf->data + buf->size;
+	if (!is_array)
+		data = mp_encode_array(data, 1);
+	memcpy(data, key, key_end - key);
+	buf->size += size;
+	buf->ends[buf->count++] = buf->size;
+	return 0;
+}
+
+/* Get the key by its number, valid until the next key_buf_add. */
+static inline char *
+key_buf_get(const struct key_buf *buf, uint32_t i, char **key_end)
+{
+	*key_end = buf->data + buf->ends[i];
+	return buf->data + (i == 0 ? 0 : buf->ends[i - 1]);
+}
+
+/* Fill the key bounds arrays with the keys of the buffer. */
+static void
+key_buf_export(const struct key_buf *buf, char **keys, char **key_ends)
+{
+	for (uint32_t i = 0; i < buf->count; i++)
+		keys[i] = key_buf_get(buf, i, &key_ends[i]);
+}
+
+/*
+ * The naive procedures free the memory used by the requests (not the
+ * keys) once per this count of tuples instead of each tuple.
+ */
+#define NAIVE_REGION_TRUNCATE_PERIOD 1024
+
+extern "C" int
+key_def_cache_stat(box_function_ctx_t *ctx,
+		   const char *args, const char *args_end)
+{
+	uint32_t size = 0;
+	for (unsigned i = 0; i < lengthof(key_def_cache); i++)
+		size += key_def_cache[i] != NULL;
+
+	char buf[128];
+	char *data = mp_encode_map(buf, 4);
+	data = mp_encode_str0(data, "size");
+	data = mp_encode_uint(data, size);
+	data = mp_encode_str0(data, "hits");
+	data = mp_encode_uint(data, key_def_cache_hits);
+	data = mp_encode_str0(data, "misses");
+	data = mp_encode_uint(data, key_def_cache_misses);
+	data = mp_encode_str0(data, "evictions");
+	data = mp_encode_uint(data, key_def_cache_evictions);
+	return box_return_mp(ctx, buf, data);
+}
+
+/*
+ * The batch iterator API, see 0002-PoC-box_iterator_next_batch.patch. It's
+ * declared weak so the module loads into the Tarantool without the patch,
+ * the pointer is NULL then.
+ */
+extern "C" int
+box_iterator_next_batch(box_iterator_t *it, box_tuple_t **tuples,
+			uint32_t size, uint32_t *count) __attribute__((weak));
+
+#define TUPLE_FETCHER_BATCH_SIZE 64
+
+/*
+ * Source of the iterator tuples: either box_iterator_next or buffered
+ * box_iterator_next_batch. A fetched tuple is valid until the next fetch,
+ * same as with box_iterator_next.
+ */
+struct tuple_fetcher {
+	box_iterator_t *it;
+	/* Set if the batch iterator API is used. */
+	bool use_batch;
+	/* The last fetched batch and the next tuple position in it. */
+	box_tuple_t *batch[TUPLE_FETCHER_BATCH_SIZE];
+	uint32_t batch_size;
+	uint32_t batch_pos;
+};
+
+static int
+tuple_fetcher_create(struct tuple_fetcher *fetcher, box_iterator_t *it,
+		     bool use_batch)
+{
+	if (use_batch && box_iterator_next_batch == NULL)
+		return ERROR("box_iterator_next_batch is not supported");
+	fetcher->it = it;
+	fetcher->use_batch = use_batch;
+	fetcher->batch_size = 0;
+	fetcher->batch_pos = 0;
+	return 0;
+}
+
+/* Switch to a new iterator, the buffered tuples are dropped. */
+static void
+tuple_fetcher_reset(struct tuple_fetcher *fetcher, box_iterator_t *it)
+{
+	fetcher->it = it;
+	fetcher->batch_size = 0;
+	fetcher->batch_pos = 0;
+}
+
+/* Get the next tuple, NULL if the iterator is exhausted. */
+static inline int
+tuple_fetcher_next(struct tuple_fetcher *fetcher, box_tuple_t **tuple)
+{
+	if (!fetcher->use_batch)
+		return box_iterator_next(fetcher->it, tuple);
+	if (fetcher->batch_pos == fetcher->batch_size) {
+		fetcher->batch_pos = 0;
+		if (box_iterator_next_batch(fetcher->it, fetcher->batch,
+					    TUPLE_FETCHER_BATCH_SIZE,
+					    &fetcher->batch_size) != 0)
 			return -1;
+		if (fetcher->batch_size == 0) {
+			*tuple = NULL;
+			return 0;
+		}
 	}
+	*tuple = fetcher->batch[fetcher->batch_pos++];
 	return 0;
 }
 
 extern "C" int
-delete_until_c_batched(box_function_ctx_t *ctx,
-		       const char *args, const char *args_end)
+delete_until_c_naive(box_function_ctx_t *ctx,
+		     const char *args, const char *args_end)
 {
 	/* Parse the arguments. */
 	if (mp_typeof(*args) != MP_ARRAY)
 		return ERROR("args not array");
 	uint32_t arg_count = mp_decode_array(&args);
-	if (arg_count != 7)
+	if (arg_count != 6)
 		return ERROR("invalid argument count: %d", arg_count);
 
 	/* Space ID. */
@@ -299,10 +718,9 @@ delete_until_c_batched(box_function_ctx_t *ctx,
 	uint32_t write_index_id = mp_decode_uint(&args);
 
 	/* Search index key_def. */
-	box_key_def_t *kd;
-	if (args_parse_key_def(&args, &kd) != 0)
+	struct key_def_cache_entry *search_parts;
+	if (args_parse_index_parts_cached(&args, &search_parts) != 0)
 		return -1;
-	auto kd_guard = make_scoped_guard([kd]() { box_key_def_delete(kd); });
 
 	/* The from key. */
 	if (mp_typeof(*args) != MP_ARRAY)
@@ -316,29 +734,13 @@ delete_until_c_batched(box_function_ctx_t *ctx,
 		return ERROR("key is not array");
 	const char *until_key = args;
 	mp_next(&args); /* Skip the key. */
-
-	/* The delete batch size. */
-	if (mp_typeof(*args) != MP_UINT)
-		return ERROR("batch size not uint");
-	uint32_t batch_size = mp_decode_uint(&args);
+	struct key_comparator until_cmp;
+	key_comparator_create(&until_cmp, search_parts, until_key);
 
 	/* That's it. */
 	if (args != args_end)
 		return ERROR("bigger input than expected");
 
-	/* Allocate the deletion key buffer. */
-	size_t region_svp = box_region_used();
-	auto region_guard = make_scoped_guard([region_svp]() {
-		box_region_truncate(region_svp);
-	});
-	char **keys = (char **)box_region_alloc(batch_size * sizeof(*keys));
-	char **key_ends =
-		(char **)box_region_alloc(batch_size * sizeof(*key_ends));
-	int keys_size = 0;
-
-	/* Next memory is for the extracted keys. */
-	size_t region_keys_svp = box_region_used();
-
 	/* Create the search index iterator. */
 	box_iterator_t *it = box_index_iterator(space_id, index_id, ITER_GE,
 						from_key, from_key_end);
@@ -346,9 +748,24 @@ delete_until_c_batched(box_function_ctx_t *ctx,
 		return ERROR("couldn't create an iterator");
 	auto it_guard = make_scoped_guard([it]() { box_iterator_free(it); });
 
-	/* Iterate over the space and delete tuple batches. */
+	/* The write index key extractor and the key buffer. */
+	struct key_extractor extractor;
+	if (key_extractor_create(&extractor, space_id, write_index_id) != 0)
+		return -1;
+	struct key_buf keys = {};
+	auto keys_guard = make_scoped_guard([&keys]() {
+		key_buf_destroy(&keys);
+	});
+
+	/* Savepoint memory used by the requests. */
+	size_t region_svp = box_region_used();
+	auto region_guard = make_scoped_guard([region_svp]() {
+		box_region_truncate(region_svp);
+	});
+
+	/* Iterate over the space and delete tuples. */
 	box_tuple_t *tuple;
-	for (;;) {
+	for (uint64_t i = 1;; i++) {
 		/* Get the next tuple. */
 		if (box_iterator_next(it, &tuple) != 0)
 			return ERROR("couldn't advance the iterator");
@@ -356,48 +773,2572 @@ delete_until_c_batched(box_function_ctx_t *ctx,
 			return ERROR("unexpected end of space");
 
 		/* The until key reached - stop deletion.*/
-		if (box_tuple_compare_with_key(tuple, until_key, kd) == 0)
+		if (key_comparator_compare(&until_cmp, tuple) == 0)
 			break;
 
-		/* Extract the tuple key and save it. */
-		uint32_t key_size;
-		char *key = box_tuple_extract_key(tuple, space_id,
-						  write_index_id, &key_size);
-		if (key == NULL)
-			return ERROR("couldn't extract key from tuple");
-		keys[keys_size] = key;
-		key_ends[keys_size++] = key + key_size;
-
-		/* Delete the batch if collected enough. */
-		if (keys_size == batch_size) {
-			for (int i = 0; i < batch_size; i++) {
-				if (box_delete(space_id, write_index_id,
-					       keys[i], key_ends[i],
-					       &tuple) != 0) {
-					return ERROR("couldn't delete a tuple");
-				}
-			}
-			keys_size = 0;
-			box_region_truncate(region_keys_svp);
-		}
-	}
-
-	/* Handle the remained collected keys not forming a full batch. */
-	for (int i = 0; i < keys_size; i++) {
-		if (box_delete(space_id, write_index_id, keys[i],
-			       key_ends[i], &tuple) != 0) {
-			return ERROR("couldn't delete a tuple in tail");
+		/* Delete the tuple. */
+		key_buf_reset(&keys);
+		if (key_buf_add(&keys, &extractor, tuple) != 0)
+			return -1;
+		char *key_end;
+		char *key = key_buf_get(&keys, 0, &key_end);
+		if (box_delete(space_id, write_index_id, key,
+			       key_end, &tuple) != 0) {
+			return ERROR("couldn't delete a tuple");
 		}
+		if (i % NAIVE_REGION_TRUNCATE_PERIOD == 0)
+			box_region_truncate(region_svp);
 	}
 	return 0;
 }
 
-extern "C" int
-delete_until_c_nocmp_batched(box_function_ctx_t *ctx,
-			     const char *args, const char *args_end)
+/*
+ * Arrow values are encoded as the widest msgpack type of their kind, the
+ * integers are encoded as MP_UINT if not negative, like Tarantool does.
+ */
+template <typename T>
+using arrow_value_t = typename std::conditional<
+	std::is_floating_point<T>::value, T, typename std::conditional<
+		std::is_signed<T>::value, int64_t, uint64_t>::type>::type;
+
+static inline uint32_t
+mp_sizeof_arrow_value(uint64_t value)
 {
-	/* Parse the arguments. */
-	if (mp_typeof(*args) != MP_ARRAY)
+	return mp_sizeof_uint(value);
+}
+
+static inline uint32_t
+mp_sizeof_arrow_value(int64_t value)
+{
+	return value >= 0 ? mp_sizeof_uint(value) : mp_sizeof_int(value);
+}
+
+static inline uint32_t
+mp_sizeof_arrow_value(float value)
+{
+	return mp_sizeof_float(value);
+}
+
+static inline uint32_t
+mp_sizeof_arrow_value(double value)
+{
+	return mp_sizeof_double(value);
+}
+
+static inline char *
+mp_encode_arrow_value(char *data, uint64_t value)
+{
+	return mp_encode_uint(data, value);
+}
+
+static inline char *
+mp_encode_arrow_value(char *data, int64_t value)
+{
+	return value >= 0 ? mp_encode_uint(data, value) :
+			    mp_encode_int(data, value);
+}
+
+static inline char *
+mp_encode_arrow_value(char *data, float value)
+{
+	return mp_encode_float(data, value);
+}
+
+static inline char *
+mp_encode_arrow_value(char *data, double value)
+{
+	return mp_encode_double(data, value);
+}
+
+static inline bool
+arrow_bit_is_set(const void *bitmap, int64_t i)
+{
+	return (((const uint8_t *)bitmap)[i >> 3] >> (i & 7)) & 1;
+}
+
+/* The validity bitmap may be omitted if the column has no nulls. */
+static inline bool
+arrow_column_has_nulls(const struct ArrowArray *column)
+{
+	return column->null_count != 0 && column->buffers[0] != NULL;
+}
+
+static inline bool
+arrow_column_is_null(const struct ArrowArray *column, int i)
+{
+	return !arrow_bit_is_set(column->buffers[0], column->offset + i);
+}
+
+/* Fixed-width column: values of type T in buffers[1]. */
+template <typename T>
+struct ArrowFixedColumn {
+	static void
+	size(const struct ArrowArray *column, int count, size_t *sizes)
+	{
+		const T *values = (const T *)column->buffers[1] +
+				  column->offset;
+		bool has_nulls = arrow_column_has_nulls(column);
+		for (int i = 0; i < count; i++) {
+			if (has_nulls && arrow_column_is_null(column, i)) {
+				sizes[i] += mp_sizeof_nil();
+				continue;
+			}
+			sizes[i] += mp_sizeof_arrow_value(
+				(arrow_value_t<T>)values[i]);
+		}
+	}
+
+	static void
+	encode(const struct ArrowArray *column, int count, char **cursors)
+	{
+		const T *values = (const T *)column->buffers[1] +
+				  column->offset;
+		bool has_nulls = arrow_column_has_nulls(column);
+		for (int i = 0; i < count; i++) {
+			if (has_nulls && arrow_column_is_null(column, i)) {
+				cursors[i] = mp_encode_nil(cursors[i]);
+				continue;
+			}
+			cursors[i] = mp_encode_arrow_value(
+				cursors[i], (arrow_value_t<T>)values[i]);
+		}
+	}
+};
+
+/* Boolean column: bit-packed values in buffers[1]. */
+struct ArrowBoolColumn {
+	static void
+	size(const struct ArrowArray *column, int count, size_t *sizes)
+	{
+		bool has_nulls = arrow_column_has_nulls(column);
+		for (int i = 0; i < count; i++) {
+			if (has_nulls && arrow_column_is_null(column, i))
+				sizes[i] += mp_sizeof_nil();
+			else
+				sizes[i] += mp_sizeof_bool(false);
+		}
+	}
+
+	static void
+	encode(const struct ArrowArray *column, int count, char **cursors)
+	{
+		bool has_nulls = arrow_column_has_nulls(column);
+		for (int i = 0; i < count; i++) {
+			if (has_nulls && arrow_column_is_null(column, i)) {
+				cursors[i] = mp_encode_nil(cursors[i]);
+				continue;
+			}
+			bool value = arrow_bit_is_set(column->buffers[1],
+						      column->offset + i);
+			cursors[i] = mp_encode_bool(cursors[i], value);
+		}
+	}
+};
+
+/*
+ * Variable-width column: int32 offsets in buffers[1] and the data in
+ * buffers[2]. Encoded as MP_STR if IS_STR is set and as MP_BIN otherwise.
+ */
+template <bool IS_STR>
+struct ArrowBinaryColumn {
+	static void
+	size(const struct ArrowArray *column, int count, size_t *sizes)
+	{
+		const int32_t *offsets = (const int32_t *)column->buffers[1] +
+					 column->offset;
+		bool has_nulls = arrow_column_has_nulls(column);
+		for (int i = 0; i < count; i++) {
+			if (has_nulls && arrow_column_is_null(column, i)) {
+				sizes[i] += mp_sizeof_nil();
+				continue;
+			}
+			uint32_t len = offsets[i + 1] - offsets[i];
+			sizes[i] += IS_STR ? mp_sizeof_str(len) :
+					     mp_sizeof_bin(len);
+		}
+	}
+
+	static void
+	encode(const struct ArrowArray *column, int count, char **cursors)
+	{
+		const int32_t *offsets = (const int32_t *)column->buffers[1] +
+					 column->offset;
+		const char *chars = (const char *)column->buffers[2];
+		bool has_nulls = arrow_column_has_nulls(column);
+		for (int i = 0; i < count; i++) {
+			if (has_nulls && arrow_column_is_null(column, i)) {
+				cursors[i] = mp_encode_nil(cursors[i]);
+				continue;
+			}
+			const char *str = chars + offsets[i];
+			uint32_t len = offsets[i + 1] - offsets[i];
+			cursors[i] = IS_STR ?
+				mp_encode_str(cursors[i], str, len) :
+				mp_encode_bin(cursors[i], str, len);
+		}
+	}
+};
+
+/* Column-at-a-time msgpack encoder of an Arrow column. */
+struct arrow_column_codec {
+	/* Add the encoded size of the first count values to sizes. */
+	void (*size)(const struct ArrowArray *column, int count,
+		     size_t *sizes);
+	/* Encode the first count values advancing the cursors. */
+	void (*encode)(const struct ArrowArray *column, int count,
+		       char **cursors);
+};
+
+template <typename Column>
+static const struct arrow_column_codec *
+arrow_column_codec_of()
+{
+	static const struct arrow_column_codec codec = {
+		Column::size, Column::encode,
+	};
+	return &codec;
+}
+
+/* Returns NULL if the field type can't be read from Arrow. */
+static const struct arrow_column_codec *
+arrow_column_codec_by_type(uint32_t type)
+{
+	switch (type) {
+	case FIELD_TYPE_UNSIGNED:
+	case FIELD_TYPE_UINT64:
+		return arrow_column_codec_of<ArrowFixedColumn<uint64_t>>();
+	case FIELD_TYPE_INTEGER:
+	case FIELD_TYPE_INT64:
+		return arrow_column_codec_of<ArrowFixedColumn<int64_t>>();
+	case FIELD_TYPE_INT8:
+		return arrow_column_codec_of<ArrowFixedColumn<int8_t>>();
+	case FIELD_TYPE_UINT8:
+		return arrow_column_codec_of<ArrowFixedColumn<uint8_t>>();
+	case FIELD_TYPE_INT16:
+		return arrow_column_codec_of<ArrowFixedColumn<int16_t>>();
+	case FIELD_TYPE_UINT16:
+		return arrow_column_codec_of<ArrowFixedColumn<uint16_t>>();
+	case FIELD_TYPE_INT32:
+		return arrow_column_codec_of<ArrowFixedColumn<int32_t>>();
+	case FIELD_TYPE_UINT32:
+		return arrow_column_codec_of<ArrowFixedColumn<uint32_t>>();
+	case FIELD_TYPE_FLOAT32:
+		return arrow_column_codec_of<ArrowFixedColumn<float>>();
+	case FIELD_TYPE_DOUBLE:
+	case FIELD_TYPE_FLOAT64:
+		return arrow_column_codec_of<ArrowFixedColumn<double>>();
+	case FIELD_TYPE_BOOLEAN:
+		return arrow_column_codec_of<ArrowBoolColumn>();
+	case FIELD_TYPE_STRING:
+		return arrow_column_codec_of<ArrowBinaryColumn<true>>();
+	case FIELD_TYPE_VARBINARY:
+		return arrow_column_codec_of<ArrowBinaryColumn<false>>();
+	default:
+		return NULL;
+	}
+}
+
+/* Get the Arrow column encoders for the index parts. */
+static int
+arrow_column_codecs_by_types(const uint32_t *types, uint32_t part_count,
+			     const struct arrow_column_codec **codecs)
+{
+	for (uint32_t i = 0; i < part_count; i++) {
+		codecs[i] = arrow_column_codec_by_type(types[i]);
+		if (codecs[i] == NULL)
+			return ERROR("Unsupported field type: %s",
+				     field_type_strs[types[i]]);
+	}
+	return 0;
+}
+
+/*
+ * Encode the first key_count rows of the batch into msgpack keys. All the
+ * keys are written into a single region buffer sized in advance, so the
+ * batch costs no heap allocations once the region is warmed up. The keys
+ * are sized and then encoded column by column, the key number i is
+ * located at [keys[i], keys[i + 1]).
+ */
+static int
+arrow_array_transpose(struct ArrowArray *array,
+		      const struct arrow_column_codec **codecs,
+		      int key_count, char ***keys)
+{
+	if (array->offset != 0)
+		return ERROR("sliced batches are not supported");
+
+	/* Single unsigned part keys are encoded in a single pass. */
+	if (array->n_children == 1 &&
+	    codecs[0] == arrow_column_codec_of<ArrowFixedColumn<uint64_t>>() &&
+	    !arrow_column_has_nulls(array->children[0])) {
+		char **bounds = (char **)box_region_alloc(
+			sizeof(*bounds) * (key_count + 1));
+		if (bounds == NULL)
+			return ERROR("can't allocate a key batch");
+		char *data = (char *)box_region_alloc(
+			mp_uint64_keys_size_max(key_count));
+		if (data == NULL)
+			return ERROR("can't allocate the keys");
+		struct ArrowArray *column = array->children[0];
+		const uint64_t *values =
+			(const uint64_t *)column->buffers[1] + column->offset;
+		mp_encode_uint64_keys(values, key_count, bounds, data);
+		*keys = bounds;
+		return 0;
+	}
+
+	/* Size the keys. */
+	size_t *sizes = (size_t *)box_region_alloc(sizeof(*sizes) * key_count);
+	if (sizes == NULL)
+		return ERROR("can't allocate the key sizes");
+	for (int row_i = 0; row_i < key_count; row_i++)
+		sizes[row_i] = mp_sizeof_array(array->n_children);
+	for (int col_i = 0; col_i < array->n_children; col_i++)
+		codecs[col_i]->size(array->children[col_i], key_count, sizes);
+
+	/* Allocate the key matrix, the bounds are prefix sums of the sizes. */
+	char **bounds =
+		(char **)box_region_alloc(sizeof(*bounds) * (key_count + 1));
+	if (bounds == NULL)
+		return ERROR("can't allocate a key batch");
+	char **cursors = (char **)box_region_alloc(sizeof(*cursors) * key_count);
+	if (cursors == NULL)
+		return ERROR("can't allocate the key cursors");
+	size_t data_size = 0;
+	for (int row_i = 0; row_i < key_count; row_i++)
+		data_size += sizes[row_i];
+	char *data = (char *)box_region_alloc(data_size);
+	if (data == NULL)
+		return ERROR("can't allocate the keys");
+	for (int row_i = 0; row_i < key_count; row_i++) {
+		bounds[row_i] = data;
+		cursors[row_i] = mp_encode_array(data, array->n_children);
+		data += sizes[row_i];
+	}
+	bounds[key_count] = data;
+
+	/* Encode the keys. */
+	for (int col_i = 0; col_i < array->n_children; col_i++)
+		codecs[col_i]->encode(array->children[col_i], key_count, cursors);
+#ifndef NDEBUG
+	for (int row_i = 0; row_i < key_count; row_i++)
+		assert(cursors[row_i] == bounds[row_i + 1]);
+#endif
+	*keys = bounds;
+	return 0;
+}
+
+/*
+ * Transaction chunking of a long range request: the transaction is
+ * committed and the fiber yields each commit_every batches to keep the
+ * TX thread responsive and the transactions small.
+ */
+struct txn_chunks {
+	/* Count of batches per transaction, 0 if not chunked. */
+	uint32_t commit_every;
+	/* Count of batches processed in the current transaction. */
+	uint32_t batch_count;
+	/* Count of transactions committed. */
+	uint64_t chunk_count;
+	/* Count of rows processed. */
+	uint64_t row_count;
+	/* Time the current transaction started at. */
+	uint64_t chunk_start;
+	/* Maximum time the TX thread didn't yield for in a transaction. */
+	uint64_t max_stall;
+};
+
+static int
+txn_chunks_begin(struct txn_chunks *chunks)
+{
+	if (chunks->commit_every == 0)
+		return 0;
+	if (box_txn())
+		return ERROR("can't commit by chunks in a transaction");
+	if (box_txn_begin() != 0)
+		return ERROR("couldn't begin a transaction");
+	chunks->chunk_start = clock_monotonic64();
+	return 0;
+}
+
+/* Account a processed batch, returns true if it's time to commit. */
+static bool
+txn_chunks_batch_done(struct txn_chunks *chunks, uint32_t row_count)
+{
+	chunks->row_count += row_count;
+	if (chunks->commit_every == 0)
+		return false;
+	return ++chunks->batch_count == chunks->commit_every;
+}
+
+static int
+txn_chunks_commit(struct txn_chunks *chunks)
+{
+	if (chunks->commit_every == 0)
+		return 0;
+	/* Don't count the WAL write, the TX thread serves others meanwhile. */
+	uint64_t stall = clock_monotonic64() - chunks->chunk_start;
+	chunks->max_stall = MAX(chunks->max_stall, stall);
+	chunks->batch_count = 0;
+	chunks->chunk_count++;
+	if (box_txn_commit() != 0)
+		return ERROR("couldn't commit a transaction");
+	return 0;
+}
+
+/*
+ * Commit the transaction, let others work and begin a new one. The commit
+ * collects the fiber garbage, so nothing allocated on the fiber region
+ * before (the call arguments included) may be used after the yield, nor
+ * a region savepoint taken before it.
+ */
+static int
+txn_chunks_yield(struct txn_chunks *chunks)
+{
+	if (txn_chunks_commit(chunks) != 0)
+		return -1;
+	fiber_sleep(0);
+	return txn_chunks_begin(chunks);
+}
+
+/* Rollback the current transaction on error. */
+static void
+txn_chunks_rollback(struct txn_chunks *chunks)
+{
+	if (chunks->commit_every != 0 && box_txn())
+		box_txn_rollback();
+}
+
+/* Return {rows = ..., chunks = ..., max_stall = <seconds>}. */
+static int
+txn_chunks_return(box_function_ctx_t *ctx, struct txn_chunks *chunks)
+{
+	char buf[128];
+	char *data = mp_encode_map(buf, 3);
+	data = mp_encode_str0(data, "rows");
+	data = mp_encode_uint(data, chunks->row_count);
+	data = mp_encode_str0(data, "chunks");
+	data = mp_encode_uint(data, chunks->chunk_count);
+	data = mp_encode_str0(data, "max_stall");
+	data = mp_encode_double(data, chunks->max_stall / 1e9);
+	return box_return_mp(ctx, buf, data);
+}
+
+/*
+ * Copy the msgpack argument [*data, *data_end) to the heap if committing by
+ * chunks: the call arguments are on the fiber region the commits free. The
+ * bounds are pointed to the copy, it's freed by the caller.
+ */
+static int
+txn_chunks_copy_arg(const struct txn_chunks *chunks, const char **data,
+		    const char **data_end, char **copy)
+{
+	*copy = NULL;
+	if (chunks->commit_every == 0)
+		return 0;
+	size_t size = *data_end - *data;
+	*copy = (char *)malloc(size);
+	if (*copy == NULL)
+		return ERROR("can't allocate an argument copy");
+	memcpy(*copy, *data, size);
+	*data = *copy;
+	*data_end = *copy + size;
+	return 0;
+}
+
+/* Radix sort item: the unsigned key and the index of the key in batch. */
+struct radix_item {
+	uint64_t value;
+	uint32_t index;
+};
+
+/*
+ * LSD radix sort by 8-bit digits, the digits equal in all the items are
+ * skipped. The histograms of all the digits are built in a single pass.
+ * Returns the sorted array: either items or tmp.
+ */
+static struct radix_item *
+radix_sort_u64(struct radix_item *items, struct radix_item *tmp, int count)
+{
+	static uint32_t counts[8][256];
+	memset(counts, 0, sizeof(counts));
+	for (int i = 0; i < count; i++) {
+		for (int digit = 0; digit < 8; digit++)
+			counts[digit][(items[i].value >> (digit * 8)) & 0xff]++;
+	}
+	for (int digit = 0; digit < 8; digit++) {
+		int shift = digit * 8;
+		if (counts[digit][(items[0].value >> shift) & 0xff] ==
+		    (uint32_t)count)
+			continue;
+		uint32_t offsets[256];
+		uint32_t offset = 0;
+		for (int i = 0; i < 256; i++) {
+			offsets[i] = offset;
+			offset += counts[digit][i];
+		}
+		for (int i = 0; i < count; i++)
+			tmp[offsets[(items[i].value >> shift) & 0xff]++] =
+				items[i];
+		struct radix_item *sorted = tmp;
+		tmp = items;
+		items = sorted;
+	}
+	return items;
+}
+
+/*
+ * Sorter of the deleted key batches in the write index order, so the
+ * deletions driven by a secondary index go to neighbour tree leaves
+ * instead of random ones. Single unsigned part keys are radix sorted,
+ * the batch keys of raw ordered parts are compared encoded, other keys
+ * are sorted by comparing the referenced batch tuples.
+ */
+struct key_batch_sorter {
+	/*
+	 * The write index key definition (of the tuples or of the keys),
+	 * NULL if the batches are not sorted. Owned by the sorter, so it
+	 * survives the yields even if the index is altered meanwhile.
+	 */
+	box_key_def_t *kd;
+	/* Set if the write index key is a single unsigned part. */
+	bool use_radix;
+	/*
+	 * Set if the batch keys are compared encoded, by their part types
+	 * (see key_part_type_is_raw), instead of by the key tuples.
+	 */
+	bool use_key_cmp;
+	uint32_t key_types[INDEX_PARTS_MAX];
+	uint32_t key_part_count;
+	/* Radix sort items and the scratch buffer for them. */
+	struct radix_item *items;
+	struct radix_item *items_tmp;
+	/* Tuples of the batch, referenced if sorting by the comparator. */
+	box_tuple_t **tuples;
+	/* Count of the tuples referenced. */
+	int tuple_count;
+	/* The order to process the batch keys in. */
+	uint32_t *order;
+};
+
+static bool
+field_type_is_unsigned(uint32_t type)
+{
+	return type == FIELD_TYPE_UNSIGNED || type == FIELD_TYPE_UINT8 ||
+	       type == FIELD_TYPE_UINT16 || type == FIELD_TYPE_UINT32 ||
+	       type == FIELD_TYPE_UINT64;
+}
+
+static bool
+field_type_is_integer(uint32_t type)
+{
+	return type == FIELD_TYPE_INTEGER || type == FIELD_TYPE_INT8 ||
+	       type == FIELD_TYPE_INT16 || type == FIELD_TYPE_INT32 ||
+	       type == FIELD_TYPE_INT64;
+}
+
+/*
+ * Check if the key parts of the type are ordered as their raw msgpack
+ * values: unsigned or integer numbers, strings without collation (bytewise)
+ * and varbinaries.
+ */
+static bool
+key_part_type_is_raw(uint32_t type)
+{
+	return field_type_is_unsigned(type) || field_type_is_integer(type) ||
+	       type == FIELD_TYPE_STRING || type == FIELD_TYPE_VARBINARY;
+}
+
+/* Check the key part value has the msgpack type of the raw part type. */
+static bool
+key_part_check_raw(const char *part, uint32_t type)
+{
+	enum mp_type mp_type = mp_typeof(*part);
+	if (field_type_is_unsigned(type))
+		return mp_type == MP_UINT;
+	if (field_type_is_integer(type))
+		return mp_type == MP_UINT || mp_type == MP_INT;
+	if (type == FIELD_TYPE_STRING)
+		return mp_type == MP_STR;
+	return mp_type == MP_BIN;
+}
+
+/* Compare the key part values checked by key_part_check_raw. */
+static inline int
+key_part_compare_raw(const char **a, const char **b)
+{
+	switch (mp_typeof(**a)) {
+	case MP_UINT:
+	case MP_INT: {
+		/* A negative value is below any unsigned one. */
+		bool a_neg = false, b_neg = false;
+		uint64_t va, vb;
+		if (mp_typeof(**a) == MP_INT) {
+			int64_t v = mp_decode_int(a);
+			a_neg = v < 0;
+			va = v;
+		} else {
+			va = mp_decode_uint(a);
+		}
+		if (mp_typeof(**b) == MP_INT) {
+			int64_t v = mp_decode_int(b);
+			b_neg = v < 0;
+			vb = v;
+		} else {
+			vb = mp_decode_uint(b);
+		}
+		if (a_neg != b_neg)
+			return a_neg ? -1 : 1;
+		/* Same sign: the two's complement order is the same. */
+		return va < vb ? -1 : va > vb;
+	}
+	case MP_STR: {
+		uint32_t len_a, len_b;
+		const char *da = mp_decode_str(a, &len_a);
+		const char *db = mp_decode_str(b, &len_b);
+		int rc = memcmp(da, db, MIN(len_a, len_b));
+		if (rc != 0)
+			return rc;
+		return len_a < len_b ? -1 : len_a > len_b;
+	}
+	default: {
+		uint32_t len_a, len_b;
+		const char *da = mp_decode_bin(a, &len_a);
+		const char *db = mp_decode_bin(b, &len_b);
+		int rc = memcmp(da, db, MIN(len_a, len_b));
+		if (rc != 0)
+			return rc;
+		return len_a < len_b ? -1 : len_a > len_b;
+	}
+	}
+}
+
+/* Compare the encoded keys checked by key_batch_sorter_check_key. */
+static inline int
+key_compare_raw(const char *a, const char *b, uint32_t part_count)
+{
+	mp_decode_array(&a);
+	mp_decode_array(&b);
+	for (uint32_t i = 0; i < part_count; i++) {
+		int rc = key_part_compare_raw(&a, &b);
+		if (rc != 0)
+			return rc;
+	}
+	return 0;
+}
+
+/*
+ * Sort in the order of the index, the key definition is taken from it. If
+ * by_key is set the batches are the keys (of the index key parts), not the
+ * space tuples. Such keys are compared encoded if all the parts are of raw
+ * ordered types (see key_part_type_is_raw), otherwise the tuples of the
+ * keys must be added. The buffers are allocated on the heap, so they
+ * survive the chunk commits. A sorter not created (zeroed) doesn't sort.
+ */
+static int
+key_batch_sorter_create(struct key_batch_sorter *sorter, uint32_t space_id,
+			uint32_t index_id, bool by_key, uint32_t batch_size)
+{
+	memset(sorter, 0, sizeof(*sorter));
+	const box_key_def_t *index_kd = box_index_key_def(space_id, index_id);
+	if (index_kd == NULL)
+		return ERROR("couldn't get the index key definition");
+	size_t region_svp = box_region_used();
+	uint32_t part_count;
+	box_key_part_def_t *parts = box_key_def_dump_parts(index_kd,
+							    &part_count);
+	if (parts == NULL)
+		return ERROR("couldn't dump the index key parts");
+	if (by_key) {
+		for (uint32_t i = 0; i < part_count; i++) {
+			parts[i].fieldno = i;
+			parts[i].path = NULL;
+		}
+	}
+	uint32_t type = strnindex(field_type_strs, parts[0].field_type,
+				  strlen(parts[0].field_type), field_type_MAX);
+	sorter->use_radix = part_count == 1 && parts[0].path == NULL &&
+			    (parts[0].flags & BOX_KEY_PART_DEF_IS_NULLABLE) == 0 &&
+			    field_type_is_unsigned(type);
+	sorter->use_key_cmp = by_key && !sorter->use_radix &&
+			      part_count <= INDEX_PARTS_MAX;
+	for (uint32_t i = 0; i < part_count && sorter->use_key_cmp; i++) {
+		type = strnindex(field_type_strs, parts[i].field_type,
+				 strlen(parts[i].field_type), field_type_MAX);
+		sorter->key_types[i] = type;
+		sorter->use_key_cmp =
+			key_part_type_is_raw(type) &&
+			(parts[i].flags & BOX_KEY_PART_DEF_IS_NULLABLE) == 0 &&
+			(parts[i].collation == NULL ||
+			 strcmp(parts[i].collation, "binary") == 0);
+	}
+	sorter->key_part_count = part_count;
+	sorter->kd = box_key_def_new_v2(parts, part_count);
+	box_region_truncate(region_svp);
+	if (sorter->kd == NULL)
+		return ERROR("couldn't create a key definition");
+	sorter->order = (uint32_t *)malloc(batch_size * sizeof(*sorter->order));
+	if (sorter->order == NULL)
+		return ERROR("can't allocate the key order");
+	if (sorter->use_radix) {
+		sorter->items = (struct radix_item *)malloc(
+			batch_size * sizeof(*sorter->items));
+		sorter->items_tmp = (struct radix_item *)malloc(
+			batch_size * sizeof(*sorter->items_tmp));
+		if (sorter->items == NULL || sorter->items_tmp == NULL)
+			return ERROR("can't allocate the radix sort items");
+	} else if (!sorter->use_key_cmp) {
+		sorter->tuples = (box_tuple_t **)malloc(
+			batch_size * sizeof(*sorter->tuples));
+		if (sorter->tuples == NULL)
+			return ERROR("can't allocate the batch tuples");
+	}
+	return 0;
+}
+
+/*
+ * Check the parts of a key column match the index: the column holds the
+ * index keys, so the parts must be {0, type0, 1, type1, ...} of the index
+ * part types.
+ */
+static int
+key_parts_check_index(const struct key_def_cache_entry *key_parts,
+		      uint32_t space_id, uint32_t index_id)
+{
+	const box_key_def_t *index_kd = box_index_key_def(space_id, index_id);
+	if (index_kd == NULL)
+		return ERROR("couldn't get the index key definition");
+	size_t region_svp = box_region_used();
+	auto region_guard = make_scoped_guard([region_svp]() {
+		box_region_truncate(region_svp);
+	});
+	uint32_t part_count;
+	box_key_part_def_t *parts = box_key_def_dump_parts(index_kd,
+							    &part_count);
+	if (parts == NULL)
+		return ERROR("couldn't dump the index key parts");
+	if (key_parts->part_count != part_count)
+		return ERROR("key part count %u doesn't match the index: %u",
+			     key_parts->part_count, part_count);
+	for (uint32_t i = 0; i < part_count; i++) {
+		uint32_t type = strnindex(field_type_strs, parts[i].field_type,
+					  strlen(parts[i].field_type),
+					  field_type_MAX);
+		if (key_parts->fields[i] != i || key_parts->types[i] != type)
+			return ERROR("key part %u doesn't match the index", i);
+	}
+	return 0;
+}
+
+/*
+ * Check the batch key (an array or a single part value) can be sorted:
+ * the radix sort and the encoded key comparison decode the keys as is.
+ */
+static int
+key_batch_sorter_check_key(struct key_batch_sorter *sorter, const char *key)
+{
+	if (!sorter->use_radix && !sorter->use_key_cmp)
+		return 0;
+	uint32_t part_count = 1;
+	if (mp_typeof(*key) == MP_ARRAY)
+		part_count = mp_decode_array(&key);
+	if (part_count != sorter->key_part_count)
+		return ERROR("key part count mismatch");
+	if (sorter->use_radix) {
+		if (mp_typeof(*key) != MP_UINT)
+			return ERROR("key not uint");
+		return 0;
+	}
+	for (uint32_t i = 0; i < part_count; i++) {
+		if (!key_part_check_raw(key, sorter->key_types[i]))
+			return ERROR("key part %u type mismatch", i);
+		mp_next(&key);
+	}
+	return 0;
+}
+
+/* Add a tuple of the batch, the keys are added in the same order. */
+static void
+key_batch_sorter_add(struct key_batch_sorter *sorter, box_tuple_t *tuple)
+{
+	if (sorter->kd == NULL || sorter->use_radix || sorter->use_key_cmp)
+		return;
+	box_tuple_ref(tuple);
+	sorter->tuples[sorter->tuple_count++] = tuple;
+}
+
+/* Get the order of the count keys in the write index. */
+static void
+key_batch_sorter_sort(struct key_batch_sorter *sorter, char **keys,
+		      int count)
+{
+	if (sorter->kd == NULL)
+		return;
+	if (sorter->use_radix) {
+		for (int i = 0; i < count; i++) {
+			const char *key = keys[i];
+			mp_decode_array(&key);
+			sorter->items[i].value = mp_decode_uint(&key);
+			sorter->items[i].index = i;
+		}
+		struct radix_item *sorted = radix_sort_u64(
+			sorter->items, sorter->items_tmp, count);
+		for (int i = 0; i < count; i++)
+			sorter->order[i] = sorted[i].index;
+		return;
+	}
+	for (int i = 0; i < count; i++)
+		sorter->order[i] = i;
+	if (sorter->use_key_cmp) {
+		uint32_t part_count = sorter->key_part_count;
+		std::sort(sorter->order, sorter->order + count,
+			  [keys, part_count](uint32_t a, uint32_t b) {
+			return key_compare_raw(keys[a], keys[b], part_count) < 0;
+		});
+		return;
+	}
+	assert(sorter->tuple_count == count);
+	box_tuple_t **tuples = sorter->tuples;
+	box_key_def_t *kd = sorter->kd;
+	std::sort(sorter->order, sorter->order + count,
+		  [tuples, kd](uint32_t a, uint32_t b) {
+		return box_tuple_compare(tuples[a], tuples[b], kd) < 0;
+	});
+}
+
+/* Index of the i-th key of the batch to process. */
+static inline int
+key_batch_sorter_at(struct key_batch_sorter *sorter, int i)
+{
+	return sorter->kd == NULL ? i : sorter->order[i];
+}
+
+/* Release the tuples of the processed batch. */
+static void
+key_batch_sorter_reset(struct key_batch_sorter *sorter)
+{
+	for (int i = 0; i < sorter->tuple_count; i++)
+		box_tuple_unref(sorter->tuples[i]);
+	sorter->tuple_count = 0;
+}
+
+static void
+key_batch_sorter_destroy(struct key_batch_sorter *sorter)
+{
+	key_batch_sorter_reset(sorter);
+	if (sorter->kd != NULL)
+		box_key_def_delete(sorter->kd);
+	free(sorter->order);
+	free(sorter->items);
+	free(sorter->items_tmp);
+	free(sorter->tuples);
+}
+
+static int
+delete_until_c_batched_impl(box_function_ctx_t *ctx, const char *args,
+			    const char *args_end, bool use_batch)
+{
+	/* Parse the arguments. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("args not array");
+	uint32_t arg_count = mp_decode_array(&args);
+	if (arg_count < 7 || arg_count > 9)
+		return ERROR("invalid argument count: %d", arg_count);
+
+	/* Space ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("space ID not uint");
+	uint32_t space_id = mp_decode_uint(&args);
+
+	/* Search index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("index ID not uint");
+	uint32_t index_id = mp_decode_uint(&args);
+
+	/* Write index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("write index ID not uint");
+	uint32_t write_index_id = mp_decode_uint(&args);
+
+	/* Search index key_def. */
+	struct key_def_cache_entry *search_parts;
+	if (args_parse_index_parts_cached(&args, &search_parts) != 0)
+		return -1;
+
+	/* The from key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *from_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *from_key_end = args;
+
+	/* The until key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *until_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *until_key_end = args;
+
+	/* The delete batch size. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("batch size not uint");
+	uint32_t batch_size = mp_decode_uint(&args);
+
+	/* The count of batches to delete per transaction (optional, 0). */
+	struct txn_chunks chunks = {};
+	if (arg_count >= 8) {
+		if (mp_typeof(*args) != MP_UINT)
+			return ERROR("commit_every not uint");
+		chunks.commit_every = mp_decode_uint(&args);
+	}
+
+	/* Sort the batches in the write index order (optional, false). */
+	bool sort = false;
+	if (arg_count >= 9) {
+		if (mp_typeof(*args) == MP_NIL)
+			mp_decode_nil(&args);
+		else if (mp_typeof(*args) == MP_BOOL)
+			sort = mp_decode_bool(&args);
+		else
+			return ERROR("sort not bool");
+	}
+
+	/* That's it. */
+	if (args != args_end)
+		return ERROR("bigger input than expected");
+
+	/* The key definition is used across the chunk commit yields. */
+	key_def_cache_entry_ref(search_parts);
+	auto parts_guard = make_scoped_guard([search_parts]() {
+		key_def_cache_entry_unref(search_parts);
+	});
+
+	/* The until key is compared with across the chunk commit yields. */
+	char *until_key_copy;
+	if (txn_chunks_copy_arg(&chunks, &until_key, &until_key_end,
+				&until_key_copy) != 0)
+		return -1;
+	auto until_key_guard = make_scoped_guard([until_key_copy]() {
+		free(until_key_copy);
+	});
+	struct key_comparator until_cmp;
+	key_comparator_create(&until_cmp, search_parts, until_key);
+
+	/* Allocate the deletion key bounds, they survive the commits. */
+	char **keys = (char **)malloc(batch_size * sizeof(*keys));
+	char **key_ends = (char **)malloc(batch_size * sizeof(*key_ends));
+	auto keys_guard = make_scoped_guard([keys, key_ends]() {
+		free(keys);
+		free(key_ends);
+	});
+	if (keys == NULL || key_ends == NULL)
+		return ERROR("can't allocate a batch");
+	int keys_size = 0;
+
+	/* The write index keys are extracted to the reusable buffer. */
+	struct key_extractor extractor;
+	if (key_extractor_create(&extractor, space_id, write_index_id) != 0)
+		return -1;
+	struct key_buf key_data = {};
+	auto key_data_guard = make_scoped_guard([&key_data]() {
+		key_buf_destroy(&key_data);
+	});
+
+	/* Sort the batches if requested. */
+	struct key_batch_sorter sorter = {};
+	auto sorter_guard = make_scoped_guard([&sorter]() {
+		key_batch_sorter_destroy(&sorter);
+	});
+	if (sort && key_batch_sorter_create(&sorter, space_id, write_index_id,
+					    false, batch_size) != 0)
+		return -1;
+
+	/* The search key of the last deleted tuple to resume from. */
+	char *resume_key = NULL;
+	auto resume_key_guard = make_scoped_guard([&resume_key]() {
+		free(resume_key);
+	});
+
+	/* Begin the first transaction if committing by chunks. */
+	if (txn_chunks_begin(&chunks) != 0)
+		return -1;
+	auto txn_guard = make_scoped_guard([&chunks]() {
+		txn_chunks_rollback(&chunks);
+	});
+
+	/*
+	 * Next memory is used by the requests of a batch. The savepoint is
+	 * taken again after each chunk commit yield.
+	 */
+	size_t region_keys_svp = box_region_used();
+	auto region_guard = make_scoped_guard([&region_keys_svp]() {
+		box_region_truncate(region_keys_svp);
+	});
+
+	/* Create the search index iterator. */
+	box_iterator_t *it = box_index_iterator(space_id, index_id, ITER_GE,
+						from_key, from_key_end);
+	if (it == NULL)
+		return ERROR("couldn't create an iterator");
+	auto it_guard = make_scoped_guard([&it]() {
+		if (it != NULL)
+			box_iterator_free(it);
+	});
+
+	/* Fetch the tuples one by one or by batches. */
+	struct tuple_fetcher fetcher;
+	if (tuple_fetcher_create(&fetcher, it, use_batch) != 0)
+		return -1;
+
+	/* Iterate over the space and delete tuple batches. */
+	box_tuple_t *tuple;
+	for (;;) {
+		/* Get the next tuple. */
+		if (tuple_fetcher_next(&fetcher, &tuple) != 0)
+			return ERROR("couldn't advance the iterator");
+		if (tuple == NULL)
+			return ERROR("unexpected end of space");
+
+		/* The until key reached - stop deletion.*/
+		if (key_comparator_compare(&until_cmp, tuple) == 0)
+			break;
+
+		/* Extract the tuple key and save it. */
+		if (key_buf_add(&key_data, &extractor, tuple) != 0)
+			return -1;
+		keys_size++;
+		key_batch_sorter_add(&sorter, tuple);
+
+		/* Delete the batch if collected enough. */
+		if (keys_size == batch_size) {
+			key_buf_export(&key_data, keys, key_ends);
+			bool commit = txn_chunks_batch_done(&chunks,
+							    batch_size);
+
+			/* Remember the search key to resume from. */
+			uint32_t resume_key_size = 0;
+			if (commit) {
+				char *search_key = box_tuple_extract_key(
+					tuple, space_id, index_id,
+					&resume_key_size);
+				if (search_key == NULL)
+					return ERROR("couldn't extract key "
+						     "from tuple");
+				char *new_resume_key = (char *)realloc(
+					resume_key, resume_key_size);
+				if (new_resume_key == NULL)
+					return ERROR("can't allocate the "
+						     "resume key");
+				resume_key = new_resume_key;
+				memcpy(resume_key, search_key,
+				       resume_key_size);
+			}
+
+			key_batch_sorter_sort(&sorter, keys, batch_size);
+			for (int i = 0; i < batch_size; i++) {
+				int k = key_batch_sorter_at(&sorter, i);
+				if (box_delete(space_id, write_index_id,
+					       keys[k], key_ends[k],
+					       &tuple) != 0) {
+					return ERROR("couldn't delete a tuple");
+				}
+			}
+			key_batch_sorter_reset(&sorter);
+			keys_size = 0;
+			key_buf_reset(&key_data);
+			box_region_truncate(region_keys_svp);
+
+			/*
+			 * Commit and yield. The tuples before the resume
+			 * key are deleted, so ITER_GE continues the range
+			 * even if the search index is not unique.
+			 */
+			if (commit) {
+				box_iterator_free(it);
+				it = NULL;
+				region_guard.is_active = false;
+				if (txn_chunks_yield(&chunks) != 0)
+					return -1;
+				region_keys_svp = box_region_used();
+				region_guard.is_active = true;
+				it = box_index_iterator(space_id, index_id,
+							ITER_GE, resume_key,
+							resume_key +
+							resume_key_size);
+				if (it == NULL)
+					return ERROR("couldn't create an "
+						     "iterator");
+				tuple_fetcher_reset(&fetcher, it);
+			}
+		}
+	}
+
+	/* Handle the remained collected keys not forming a full batch. */
+	key_buf_export(&key_data, keys, key_ends);
+	key_batch_sorter_sort(&sorter, keys, keys_size);
+	for (int i = 0; i < keys_size; i++) {
+		int k = key_batch_sorter_at(&sorter, i);
+		if (box_delete(space_id, write_index_id, keys[k],
+			       key_ends[k], &tuple) != 0) {
+			return ERROR("couldn't delete a tuple in tail");
+		}
+	}
+	txn_chunks_batch_done(&chunks, keys_size);
+	box_region_truncate(region_keys_svp);
+	region_guard.is_active = false;
+	if (txn_chunks_commit(&chunks) != 0)
+		return -1;
+	txn_guard.is_active = false;
+	return txn_chunks_return(ctx, &chunks);
+}
+
+extern "C" int
+delete_until_c_batched(box_function_ctx_t *ctx,
+		       const char *args, const char *args_end)
+{
+	return delete_until_c_batched_impl(ctx, args, args_end, false);
+}
+
+/*
+ * Same as delete_until_c_batched, but iterates by
+ * box_iterator_next_batch.
+ */
+extern "C" int
+delete_until_c_batched_next_batch(box_function_ctx_t *ctx, const char *args,
+				  const char *args_end)
+{
+	return delete_until_c_batched_impl(ctx, args, args_end, true);
+}
+
+/*
+ * Lookahead over an iterator: keeps up to size next tuples in a ring
+ * buffer. The header of each tuple is prefetched as soon as it's fetched,
+ * and once it's halfway through the ring (the header is in cache by then)
+ * the data of its field is prefetched, so both are in cache by the time
+ * the tuple is compared or has its key extracted. The ring is allocated on
+ * the region.
+ *
+ * The tuples in the ring are not referenced, it would bring back the cache
+ * miss per tuple the lookahead hides. So the tuples must be kept alive by
+ * the space: only for the engines returning the stored tuples (MemTX), the
+ * tuples ahead must not be deleted and the caller must not yield.
+ */
+struct tuple_lookahead {
+	box_iterator_t *it;
+	box_tuple_t **ring;
+	/* Capacity of the ring. */
+	uint32_t size;
+	/* Position of the next tuple to return. */
+	uint32_t head;
+	/* Count of the tuples in the ring. */
+	uint32_t count;
+	/* The field to prefetch the data of: the first one accessed. */
+	uint32_t fieldno;
+	/* Set if the iterator is exhausted. */
+	bool is_eof;
+};
+
+static int
+tuple_lookahead_create(struct tuple_lookahead *la, box_iterator_t *it,
+		       uint32_t size, uint32_t fieldno)
+{
+	memset(la, 0, sizeof(*la));
+	if (size == 0)
+		return ERROR("lookahead must be positive");
+	la->ring = (box_tuple_t **)box_region_alloc(size * sizeof(*la->ring));
+	if (la->ring == NULL)
+		return ERROR("can't allocate the lookahead ring");
+	la->it = it;
+	la->size = size;
+	la->fieldno = fieldno;
+	return 0;
+}
+
+/* Get the next tuple, NULL if the iterator is exhausted. */
+static int
+tuple_lookahead_next(struct tuple_lookahead *la, box_tuple_t **result)
+{
+	while (la->count < la->size && !la->is_eof) {
+		box_tuple_t *tuple;
+		if (box_iterator_next(la->it, &tuple) != 0)
+			return -1;
+		if (tuple == NULL) {
+			la->is_eof = true;
+			break;
+		}
+		__builtin_prefetch(tuple);
+		la->ring[(la->head + la->count++) % la->size] = tuple;
+	}
+	if (la->count == 0) {
+		*result = NULL;
+		return 0;
+	}
+	box_tuple_t *halfway = la->ring[(la->head + la->count / 2) % la->size];
+	const char *field = box_tuple_field(halfway, la->fieldno);
+	if (field != NULL)
+		__builtin_prefetch(field);
+	*result = la->ring[la->head];
+	la->head = (la->head + 1) % la->size;
+	la->count--;
+	return 0;
+}
+
+extern "C" int
+delete_until_c_batched_lookahead(box_function_ctx_t *ctx,
+				 const char *args, const char *args_end)
+{
+	/* Parse the arguments. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("args not array");
+	uint32_t arg_count = mp_decode_array(&args);
+	if (arg_count != 8)
+		return ERROR("invalid argument count: %d", arg_count);
+
+	/* Space ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("space ID not uint");
+	uint32_t space_id = mp_decode_uint(&args);
+
+	/* Search index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("index ID not uint");
+	uint32_t index_id = mp_decode_uint(&args);
+
+	/* Write index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("write index ID not uint");
+	uint32_t write_index_id = mp_decode_uint(&args);
+
+	/* Search index key_def. */
+	struct key_def_cache_entry *search_parts;
+	if (args_parse_index_parts_cached(&args, &search_parts) != 0)
+		return -1;
+
+	/* The from key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *from_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *from_key_end = args;
+
+	/* The until key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *until_key = args;
+	mp_next(&args); /* Skip the key. */
+	struct key_comparator until_cmp;
+	key_comparator_create(&until_cmp, search_parts, until_key);
+
+	/* The delete batch size. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("batch size not uint");
+	uint32_t batch_size = mp_decode_uint(&args);
+
+	/* The count of tuples to fetch ahead. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("lookahead not uint");
+	uint32_t lookahead = mp_decode_uint(&args);
+
+	/* That's it. */
+	if (args != args_end)
+		return ERROR("bigger input than expected");
+
+	/* Allocate the deletion key bounds. */
+	size_t region_svp = box_region_used();
+	auto region_guard = make_scoped_guard([region_svp]() {
+		box_region_truncate(region_svp);
+	});
+	char **keys = (char **)box_region_alloc(batch_size * sizeof(*keys));
+	char **key_ends =
+		(char **)box_region_alloc(batch_size * sizeof(*key_ends));
+	int keys_size = 0;
+
+	/* The write index keys are extracted to the reusable buffer. */
+	struct key_extractor extractor;
+	if (key_extractor_create(&extractor, space_id, write_index_id) != 0)
+		return -1;
+	struct key_buf key_data = {};
+	auto key_data_guard = make_scoped_guard([&key_data]() {
+		key_buf_destroy(&key_data);
+	});
+
+	/* Create the search index iterator. */
+	box_iterator_t *it = box_index_iterator(space_id, index_id, ITER_GE,
+						from_key, from_key_end);
+	if (it == NULL)
+		return ERROR("couldn't create an iterator");
+	auto it_guard = make_scoped_guard([it]() { box_iterator_free(it); });
+
+	/*
+	 * Fetch the tuples ahead of the deleted ones. The deleted tuples are
+	 * behind the iterator, so the tuples ahead stay in the space.
+	 */
+	struct tuple_lookahead la;
+	if (tuple_lookahead_create(&la, it, lookahead,
+				   search_parts->fields[0]) != 0)
+		return -1;
+
+	/* Next memory is used by the requests of a batch. */
+	size_t region_keys_svp = box_region_used();
+
+	/* Iterate over the space and delete tuple batches. */
+	box_tuple_t *tuple;
+	for (;;) {
+		/* Get the next tuple. */
+		if (tuple_lookahead_next(&la, &tuple) != 0)
+			return ERROR("couldn't advance the iterator");
+		if (tuple == NULL)
+			return ERROR("unexpected end of space");
+
+		/* The until key reached - stop deletion.*/
+		if (key_comparator_compare(&until_cmp, tuple) == 0)
+			break;
+
+		/* Extract the tuple key and save it. */
+		if (key_buf_add(&key_data, &extractor, tuple) != 0)
+			return -1;
+		keys_size++;
+
+		/* Delete the batch if collected enough. */
+		if (keys_size == batch_size) {
+			key_buf_export(&key_data, keys, key_ends);
+			for (int i = 0; i < batch_size; i++) {
+				if (box_delete(space_id, write_index_id,
+					       keys[i], key_ends[i],
+					       &tuple) != 0) {
+					return ERROR("couldn't delete a tuple");
+				}
+			}
+			keys_size = 0;
+			key_buf_reset(&key_data);
+			box_region_truncate(region_keys_svp);
+		}
+	}
+
+	/* Handle the remained collected keys not forming a full batch. */
+	key_buf_export(&key_data, keys, key_ends);
+	for (int i = 0; i < keys_size; i++) {
+		if (box_delete(space_id, write_index_id, keys[i],
+			       key_ends[i], &tuple) != 0) {
+			return ERROR("couldn't delete a tuple in tail");
+		}
+	}
+	return 0;
+}
+
+static int
+delete_until_c_nocmp_batched_impl(box_function_ctx_t *ctx, const char *args,
+				  const char *args_end, bool use_batch)
+{
+	/* Parse the arguments. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("args not array");
+	uint32_t arg_count = mp_decode_array(&args);
+	if (arg_count != 7)
+		return ERROR("invalid argument count: %d", arg_count);
+
+	/* Space ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("space ID not uint");
+	uint32_t space_id = mp_decode_uint(&args);
+
+	/* Search index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("index ID not uint");
+	uint32_t index_id = mp_decode_uint(&args);
+
+	/* Write index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("write index ID not uint");
+	uint32_t write_index_id = mp_decode_uint(&args);
+
+	/* Search index key_def. */
+	box_key_def_t *kd;
+	if (args_parse_key_def(&args, &kd) != 0)
+		return -1;
+
+	/* The from key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *from_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *from_key_end = args;
+
+	/* The until key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *until_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *until_key_end = args;
+
+	/* The delete batch size. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("batch size not uint");
+	uint32_t batch_size = mp_decode_uint(&args);
+
+	/* That's it. */
+	if (args != args_end)
+		return ERROR("bigger input than expected");
+
+	/* Get the amount to delete. */
+	ssize_t rows_remained = box_index_count(space_id, index_id, ITER_LT,
+						until_key, until_key_end);
+	if (rows_remained < 0)
+		return ERROR("can't count the amount to delete");
+
+	/* Allocate the deletion key bounds. */
+	size_t region_svp = box_region_used();
+	auto region_guard = make_scoped_guard([region_svp]() {
+		box_region_truncate(region_svp);
+	});
+	char **keys = (char **)box_region_alloc(batch_size * sizeof(*keys));
+	char **key_ends =
+		(char **)box_region_alloc(batch_size * sizeof(*key_ends));
+	int keys_size = 0;
+
+	/* The write index keys are extracted to the reusable buffer. */
+	struct key_extractor extractor;
+	if (key_extractor_create(&extractor, space_id, write_index_id) != 0)
+		return -1;
+	struct key_buf key_data = {};
+	auto key_data_guard = make_scoped_guard([&key_data]() {
+		key_buf_destroy(&key_data);
+	});
+
+	/* Next memory is used by the requests of a batch. */
+	size_t region_keys_svp = box_region_used();
+
+	/* Create the search index iterator. */
+	box_iterator_t *it = box_index_iterator(space_id, index_id, ITER_GE,
+						from_key, from_key_end);
+	if (it == NULL)
+		return ERROR("couldn't create an iterator");
+	auto it_guard = make_scoped_guard([it]() { box_iterator_free(it); });
+
+	/* Fetch the tuples one by one or by batches. */
+	struct tuple_fetcher fetcher;
+	if (tuple_fetcher_create(&fetcher, it, use_batch) != 0)
+		return -1;
+
+	/* Iterate over the space and delete tuple batches. */
+	box_tuple_t *tuple;
+	while (rows_remained) {
+		/* Get the next tuple. */
+		if (tuple_fetcher_next(&fetcher, &tuple) != 0)
+			return ERROR("couldn't advance the iterator");
+		if (tuple == NULL)
+			return ERROR("unexpected end of space");
+
+		/* Extract the tuple key and save it. */
+		if (key_buf_add(&key_data, &extractor, tuple) != 0)
+			return -1;
+		keys_size++;
+		rows_remained--;
+
+		/* Delete the batch if collected enough. */
+		if (keys_size == batch_size) {
+			key_buf_export(&key_data, keys, key_ends);
+			for (int i = 0; i < batch_size; i++) {
+				if (box_delete(space_id, write_index_id,
+					       keys[i], key_ends[i],
+					       &tuple) != 0) {
+					return ERROR("couldn't delete a tuple");
+				}
+			}
+			keys_size = 0;
+			key_buf_reset(&key_data);
+			box_region_truncate(region_keys_svp);
+		}
+	}
+
+	/* Handle the remained collected keys not forming a full batch. */
+	key_buf_export(&key_data, keys, key_ends);
+	for (int i = 0; i < keys_size; i++) {
+		if (box_delete(space_id, write_index_id, keys[i],
+			       key_ends[i], &tuple) != 0) {
+			return ERROR("couldn't delete a tuple in tail");
+		}
+	}
+	return 0;
+}
+
+extern "C" int
+delete_until_c_nocmp_batched(box_function_ctx_t *ctx,
+			     const char *args, const char *args_end)
+{
+	return delete_until_c_nocmp_batched_impl(ctx, args, args_end, false);
+}
+
+/*
+ * Same as delete_until_c_nocmp_batched, but iterates by
+ * box_iterator_next_batch.
+ */
+extern "C" int
+delete_until_c_nocmp_batched_next_batch(box_function_ctx_t *ctx,
+					const char *args, const char *args_end)
+{
+	return delete_until_c_nocmp_batched_impl(ctx, args, args_end, true);
+}
+
+extern "C" int
+delete_until_c_nocmp_arrow(box_function_ctx_t *ctx,
+			   const char *args, const char *args_end)
+{
+	/* Parse the arguments. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("args not array");
+	uint32_t arg_count = mp_decode_array(&args);
+	if (arg_count != 8)
+		return ERROR("invalid argument count: %d", arg_count);
+
+	/* Space ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("space ID not uint");
+	uint32_t space_id = mp_decode_uint(&args);
+
+	/* Search index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("index ID not uint");
+	uint32_t index_id = mp_decode_uint(&args);
+
+	/* Write index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("write index ID not uint");
+	uint32_t write_index_id = mp_decode_uint(&args);
+
+	/* Search index key_def. */
+	box_key_def_t *kd;
+	if (args_parse_key_def(&args, &kd) != 0)
+		return -1;
+
+	/* Write index parts. */
+	struct key_def_cache_entry *write_parts;
+	if (args_parse_index_parts_cached(&args, &write_parts) != 0)
+		return -1;
+	uint32_t *fields = write_parts->fields;
+	uint32_t part_count = write_parts->part_count;
+	const struct arrow_column_codec *codecs[INDEX_PARTS_MAX];
+	if (arrow_column_codecs_by_types(write_parts->types, part_count,
+					 codecs) != 0)
+		return -1;
+
+	/* The from key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *from_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *from_key_end = args;
+
+	/* The until key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *until_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *until_key_end = args;
+
+	/* The delete batch size. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("batch size not uint");
+	uint32_t batch_size = mp_decode_uint(&args);
+
+	/* That's it. */
+	if (args != args_end)
+		return ERROR("bigger input than expected");
+
+	/* Get the amount to delete. */
+	ssize_t rows_remained = box_index_count(space_id, index_id, ITER_LT,
+						until_key, until_key_end);
+	if (rows_remained < 0)
+		return ERROR("can't count the amount to delete");
+
+	/* Create the search index scanner. */
+	struct ArrowArrayStream stream = {};
+	box_arrow_options_t *options = box_arrow_options_new();
+	auto arrow_options_guard = make_scoped_guard([options]() {
+		box_arrow_options_delete(options);
+	});
+	box_arrow_options_set_iterator(options, ITER_GE);
+	box_arrow_options_set_batch_row_count(options, batch_size);
+	if (box_index_arrow_stream(space_id, index_id, part_count,
+				   fields, from_key, from_key_end,
+				   options, &stream) != 0)
+		return ERROR("couldn't create an Arrow stream");
+	auto it_guard = make_scoped_guard([&stream]() {
+		if (stream.release != NULL)
+			stream.release(&stream);
+	});
+
+	/* Scan the write index part batches and delete the rows. */
+	while (rows_remained > 0) {
+		size_t region_svp = box_region_used();
+		auto region_guard = make_scoped_guard([region_svp]() {
+			box_region_truncate(region_svp);
+		});
+
+		/* Get the next batch. */
+		struct ArrowArray array = {};
+		if (stream.get_next(&stream, &array) != 0)
+			return ERROR("couldn't read the next stream batch");
+		auto array_guard = make_scoped_guard([&array]() {
+			if (array.release != NULL)
+				array.release(&array);
+		});
+		if (array.release == NULL || array.n_children == 0)
+			break; /* End of data. */
+		if (array.n_children != part_count)
+			return ERROR("unexpected n_children: %d", array.n_children);
+
+		/* Transpose the batch (get msgpack keys). */
+		int key_count = MIN(array.length, rows_remained);
+		char **keys;
+		if (arrow_array_transpose(&array, codecs, key_count, &keys) != 0)
+			return -1;
+
+		/* Drop the keys. */
+		for (int i = 0; i < key_count; i++) {
+			box_tuple_t *dummy;
+			if (box_delete(space_id, write_index_id,
+				       keys[i], keys[i + 1], &dummy) != 0) {
+				return ERROR("couldn't delete a tuple");
+			}
+		}
+		rows_remained -= key_count;
+	}
+	return 0;
+}
+
+/*
+ * The range deletion API, see 0003-PoC-memtx-tree-delete_range.patch.
+ * Declared weak, NULL if the Tarantool is not patched.
+ */
+extern "C" int
+box_index_delete_range(uint32_t space_id, uint32_t index_id,
+		       const char *from_key, const char *from_key_end,
+		       const char *until_key, const char *until_key_end)
+	__attribute__((weak));
+
+extern "C" int
+delete_until_c_range_api(box_function_ctx_t *ctx,
+			 const char *args, const char *args_end)
+{
+	/* Parse the arguments. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("args not array");
+	uint32_t arg_count = mp_decode_array(&args);
+	if (arg_count != 4)
+		return ERROR("invalid argument count: %d", arg_count);
+
+	/* Space ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("space ID not uint");
+	uint32_t space_id = mp_decode_uint(&args);
+
+	/* Write index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("write index ID not uint");
+	uint32_t write_index_id = mp_decode_uint(&args);
+
+	/* The from key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *from_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *from_key_end = args;
+
+	/* The until key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *until_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *until_key_end = args;
+
+	/* That's it. */
+	if (args != args_end)
+		return ERROR("bigger input than expected");
+
+	if (box_index_delete_range == NULL)
+		return ERROR("box_index_delete_range is not supported");
+	if (box_index_delete_range(space_id, write_index_id, from_key,
+				   from_key_end, until_key,
+				   until_key_end) != 0)
+		return -1;
+	return 0;
+}
+
+extern "C" int
+update_until_c_naive(box_function_ctx_t *ctx,
+		     const char *args, const char *args_end)
+{
+	/* Parse the arguments. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("args not array");
+	uint32_t arg_count = mp_decode_array(&args);
+	if (arg_count != 7)
+		return ERROR("invalid argument count: %d", arg_count);
+
+	/* Space ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("space ID not uint");
+	uint32_t space_id = mp_decode_uint(&args);
+
+	/* Search index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("index ID not uint");
+	uint32_t index_id = mp_decode_uint(&args);
+
+	/* Write index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("write index ID not uint");
+	uint32_t write_index_id = mp_decode_uint(&args);
+
+	/* Search index key_def. */
+	struct key_def_cache_entry *search_parts;
+	if (args_parse_index_parts_cached(&args, &search_parts) != 0)
+		return -1;
+
+	/* Update ops. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("non-array update ops");
+	const char *ops = args;
+	mp_next(&args); /* Skip the options without checking. */
+	const char *ops_end = args;
+
+	/* The from key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *from_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *from_key_end = args;
+
+	/* The until key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *until_key = args;
+	mp_next(&args); /* Skip the key. */
+	struct key_comparator until_cmp;
+	key_comparator_create(&until_cmp, search_parts, until_key);
+
+	/* That's it. */
+	if (args != args_end)
+		return ERROR("bigger input than expected");
+
+	/* Create the search index iterator. */
+	box_iterator_t *it = box_index_iterator(space_id, index_id, ITER_GE,
+						from_key, from_key_end);
+	if (it == NULL)
+		return ERROR("couldn't create an iterator");
+	auto it_guard = make_scoped_guard([it]() { box_iterator_free(it); });
+
+	/* The write index key extractor and the key buffer. */
+	struct key_extractor extractor;
+	if (key_extractor_create(&extractor, space_id, write_index_id) != 0)
+		return -1;
+	struct key_buf keys = {};
+	auto keys_guard = make_scoped_guard([&keys]() {
+		key_buf_destroy(&keys);
+	});
+
+	/* Savepoint memory used by the requests. */
+	size_t region_svp = box_region_used();
+	auto region_guard = make_scoped_guard([region_svp]() {
+		box_region_truncate(region_svp);
+	});
+
+	/* Iterate over the space and update tuples. */
+	box_tuple_t *tuple;
+	for (uint64_t i = 1;; i++) {
+		/* Get the next tuple. */
+		if (box_iterator_next(it, &tuple) != 0)
+			return ERROR("couldn't advance the iterator");
+		if (tuple == NULL)
+			return ERROR("unexpected end of space");
+
+		/* The until key reached - stop update.*/
+		if (key_comparator_compare(&until_cmp, tuple) == 0)
+			break;
+
+		/* Update the tuple. */
+		key_buf_reset(&keys);
+		if (key_buf_add(&keys, &extractor, tuple) != 0)
+			return -1;
+		char *key_end;
+		char *key = key_buf_get(&keys, 0, &key_end);
+		if (box_update(space_id, write_index_id, key, key_end,
+			       ops, ops_end, 1, &tuple) != 0)
+			return ERROR("couldn't update a tuple");
+		if (i % NAIVE_REGION_TRUNCATE_PERIOD == 0)
+			box_region_truncate(region_svp);
+	}
+	return 0;
+}
+
+static int
+update_until_c_batched_impl(box_function_ctx_t *ctx, const char *args,
+			    const char *args_end, bool use_batch)
+{
+	/* Parse the arguments. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("args not array");
+	uint32_t arg_count = mp_decode_array(&args);
+	if (arg_count != 8 && arg_count != 9)
+		return ERROR("invalid argument count: %d", arg_count);
+
+	/* Space ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("space ID not uint");
+	uint32_t space_id = mp_decode_uint(&args);
+
+	/* Search index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("index ID not uint");
+	uint32_t index_id = mp_decode_uint(&args);
+
+	/* Write index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("write index ID not uint");
+	uint32_t write_index_id = mp_decode_uint(&args);
+
+	/* Search index key_def. */
+	struct key_def_cache_entry *search_parts;
+	if (args_parse_index_parts_cached(&args, &search_parts) != 0)
+		return -1;
+
+	/* Update ops. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("non-array update ops");
+	const char *ops = args;
+	mp_next(&args); /* Skip the options without checking. */
+	const char *ops_end = args;
+
+	/* The from key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *from_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *from_key_end = args;
+
+	/* The until key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *until_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *until_key_end = args;
+
+	/* The update batch size. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("batch size not uint");
+	uint32_t batch_size = mp_decode_uint(&args);
+
+	/* The count of batches to update per transaction (optional). */
+	struct txn_chunks chunks = {};
+	if (arg_count == 9) {
+		if (mp_typeof(*args) != MP_UINT)
+			return ERROR("commit_every not uint");
+		chunks.commit_every = mp_decode_uint(&args);
+	}
+
+	/*
+	 * The iterator is kept across yields, so the tuples fetched ahead by
+	 * a batch could be changed by others meanwhile.
+	 */
+	if (use_batch && chunks.commit_every != 0)
+		return ERROR("commit_every is not supported with next_batch");
+
+	/* That's it. */
+	if (args != args_end)
+		return ERROR("bigger input than expected");
+
+	/* The key definition is used across the chunk commit yields. */
+	key_def_cache_entry_ref(search_parts);
+	auto parts_guard = make_scoped_guard([search_parts]() {
+		key_def_cache_entry_unref(search_parts);
+	});
+
+	/*
+	 * The until key, the update ops and the from key (the iterator may
+	 * refer to it) are used across the chunk commit yields.
+	 */
+	char *until_key_copy, *ops_copy, *from_key_copy;
+	if (txn_chunks_copy_arg(&chunks, &until_key, &until_key_end,
+				&until_key_copy) != 0)
+		return -1;
+	auto until_key_guard = make_scoped_guard([until_key_copy]() {
+		free(until_key_copy);
+	});
+	if (txn_chunks_copy_arg(&chunks, &ops, &ops_end, &ops_copy) != 0)
+		return -1;
+	auto ops_guard = make_scoped_guard([ops_copy]() {
+		free(ops_copy);
+	});
+	if (txn_chunks_copy_arg(&chunks, &from_key, &from_key_end,
+				&from_key_copy) != 0)
+		return -1;
+	auto from_key_guard = make_scoped_guard([from_key_copy]() {
+		free(from_key_copy);
+	});
+	struct key_comparator until_cmp;
+	key_comparator_create(&until_cmp, search_parts, until_key);
+
+	/* Allocate the update key bounds, they survive the commits. */
+	char **keys = (char **)malloc(batch_size * sizeof(*keys));
+	char **key_ends = (char **)malloc(batch_size * sizeof(*key_ends));
+	auto keys_guard = make_scoped_guard([keys, key_ends]() {
+		free(keys);
+		free(key_ends);
+	});
+	if (keys == NULL || key_ends == NULL)
+		return ERROR("can't allocate a batch");
+	int keys_size = 0;
+
+	/* The write index keys are extracted to the reusable buffer. */
+	struct key_extractor extractor;
+	if (key_extractor_create(&extractor, space_id, write_index_id) != 0)
+		return -1;
+	struct key_buf key_data = {};
+	auto key_data_guard = make_scoped_guard([&key_data]() {
+		key_buf_destroy(&key_data);
+	});
+
+	/* Begin the first transaction if committing by chunks. */
+	if (txn_chunks_begin(&chunks) != 0)
+		return -1;
+	auto txn_guard = make_scoped_guard([&chunks]() {
+		txn_chunks_rollback(&chunks);
+	});
+
+	/*
+	 * Next memory is used by the requests of a batch. The savepoint is
+	 * taken again after each chunk commit yield.
+	 */
+	size_t region_keys_svp = box_region_used();
+	auto region_guard = make_scoped_guard([&region_keys_svp]() {
+		box_region_truncate(region_keys_svp);
+	});
+
+	/* Create the search index iterator. */
+	box_iterator_t *it = box_index_iterator(space_id, index_id, ITER_GE,
+						from_key, from_key_end);
+	if (it == NULL)
+		return ERROR("couldn't create an iterator");
+	auto it_guard = make_scoped_guard([it]() { box_iterator_free(it); });
+
+	/* Fetch the tuples one by one or by batches. */
+	struct tuple_fetcher fetcher;
+	if (tuple_fetcher_create(&fetcher, it, use_batch) != 0)
+		return -1;
+
+	/* Iterate over the space and update tuple batches. */
+	box_tuple_t *tuple;
+	for (;;) {
+		/* Get the next tuple. */
+		if (tuple_fetcher_next(&fetcher, &tuple) != 0)
+			return ERROR("couldn't advance the iterator");
+		if (tuple == NULL)
+			return ERROR("unexpected end of space");
+
+		/* The until key reached - stop update. */
+		if (key_comparator_compare(&until_cmp, tuple) == 0)
+			break;
+
+		/* Extract the tuple key and save it. */
+		if (key_buf_add(&key_data, &extractor, tuple) != 0)
+			return -1;
+		keys_size++;
+
+		/* Update the batch if collected enough. */
+		if (keys_size == batch_size) {
+			key_buf_export(&key_data, keys, key_ends);
+			for (int i = 0; i < batch_size; i++) {
+				if (box_update(space_id, write_index_id,
+					       keys[i], key_ends[i],
+					       ops, ops_end, 1, &tuple) != 0) {
+					return ERROR("couldn't update a tuple");
+				}
+			}
+			keys_size = 0;
+			key_buf_reset(&key_data);
+			box_region_truncate(region_keys_svp);
+
+			/*
+			 * Commit and yield. The updated tuples remain in the
+			 * index, so the iterator is kept: it continues after
+			 * the last updated tuple.
+			 */
+			if (txn_chunks_batch_done(&chunks, batch_size)) {
+				region_guard.is_active = false;
+				if (txn_chunks_yield(&chunks) != 0)
+					return -1;
+				region_keys_svp = box_region_used();
+				region_guard.is_active = true;
+			}
+		}
+	}
+
+	/* Handle the remained collected keys not forming a full batch. */
+	key_buf_export(&key_data, keys, key_ends);
+	for (int i = 0; i < keys_size; i++) {
+		if (box_update(space_id, write_index_id, keys[i], key_ends[i],
+			       ops, ops_end, 1, &tuple) != 0) {
+			return ERROR("couldn't update a tuple in tail");
+		}
+	}
+	txn_chunks_batch_done(&chunks, keys_size);
+	box_region_truncate(region_keys_svp);
+	region_guard.is_active = false;
+	if (txn_chunks_commit(&chunks) != 0)
+		return -1;
+	txn_guard.is_active = false;
+	return txn_chunks_return(ctx, &chunks);
+}
+
+extern "C" int
+update_until_c_batched(box_function_ctx_t *ctx,
+		       const char *args, const char *args_end)
+{
+	return update_until_c_batched_impl(ctx, args, args_end, false);
+}
+
+/*
+ * Same as update_until_c_batched, but iterates by
+ * box_iterator_next_batch.
+ */
+extern "C" int
+update_until_c_batched_next_batch(box_function_ctx_t *ctx, const char *args,
+				  const char *args_end)
+{
+	return update_until_c_batched_impl(ctx, args, args_end, true);
+}
+
+/*
+ * The borrowed tuple iterator API, see the 0007-PoC-BOX_ITER_NOREF patch.
+ * Declared weak, NULL if the Tarantool is not patched.
+ */
+extern "C" box_iterator_t *
+box_index_iterator_ex(uint32_t space_id, uint32_t index_id, int type,
+		      const char *key, const char *key_end, uint32_t flags)
+	__attribute__((weak));
+
+#ifndef BOX_ITER_NOREF
+#define BOX_ITER_NOREF (1 << 0)
+#endif
+
+static int
+process_until_c_impl(box_function_ctx_t *ctx, const char *args,
+		     const char *args_end, bool use_batch)
+{
+	/* Parse the arguments. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("args not array");
+	uint32_t arg_count = mp_decode_array(&args);
+	if (arg_count != 5 && arg_count != 6)
+		return ERROR("invalid argument count: %d", arg_count);
+
+	/* Space ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("space ID not uint");
+	uint32_t space_id = mp_decode_uint(&args);
+
+	/* Search index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("index ID not uint");
+	uint32_t index_id = mp_decode_uint(&args);
+
+	/* Search index key_def. */
+	struct key_def_cache_entry *search_parts;
+	if (args_parse_index_parts_cached(&args, &search_parts) != 0)
+		return -1;
+
+	/* The from key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *from_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *from_key_end = args;
+
+	/* The until key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *until_key = args;
+	mp_next(&args); /* Skip the key. */
+	struct key_comparator until_cmp;
+	key_comparator_create(&until_cmp, search_parts, until_key);
+
+	/* Borrow the tuples instead of referencing them (optional). */
+	bool noref = false;
+	if (arg_count > 5) {
+		if (mp_typeof(*args) != MP_BOOL)
+			return ERROR("noref not bool");
+		noref = mp_decode_bool(&args);
+	}
+
+	/* That's it. */
+	if (args != args_end)
+		return ERROR("bigger input than expected");
+
+	/* Create the search index iterator, it's not yielded across. */
+	box_iterator_t *it;
+	if (noref) {
+		if (box_index_iterator_ex == NULL)
+			return ERROR("box_index_iterator_ex is not supported");
+		it = box_index_iterator_ex(space_id, index_id, ITER_GE,
+					   from_key, from_key_end,
+					   BOX_ITER_NOREF);
+	} else {
+		it = box_index_iterator(space_id, index_id, ITER_GE,
+					from_key, from_key_end);
+	}
+	if (it == NULL)
+		return ERROR("couldn't create an iterator");
+	auto it_guard = make_scoped_guard([it]() { box_iterator_free(it); });
+
+	/* Fetch the tuples one by one or by batches. */
+	struct tuple_fetcher fetcher;
+	if (tuple_fetcher_create(&fetcher, it, use_batch) != 0)
+		return -1;
+
+	/* Iterate over the space and delete tuples. */
+	box_tuple_t *tuple;
+	for (;;) {
+		/* Get the next tuple. */
+		if (tuple_fetcher_next(&fetcher, &tuple) != 0)
+			return ERROR("couldn't advance the iterator");
+		if (tuple == NULL)
+			return ERROR("unexpected end of space");
+
+		/* The until key reached - stop processing.*/
+		if (key_comparator_compare(&until_cmp, tuple) == 0)
+			break;
+
+		/* Process the tuple. */
+	}
+	return 0;
+}
+
+extern "C" int
+process_until_c(box_function_ctx_t *ctx, const char *args, const char *args_end)
+{
+	return process_until_c_impl(ctx, args, args_end, false);
+}
+
+/* Same as process_until_c, but iterates by box_iterator_next_batch. */
+extern "C" int
+process_until_c_next_batch(box_function_ctx_t *ctx, const char *args,
+			   const char *args_end)
+{
+	return process_until_c_impl(ctx, args, args_end, true);
+}
+
+extern "C" int
+process_until_c_lookahead(box_function_ctx_t *ctx, const char *args,
+			  const char *args_end)
+{
+	/* Parse the arguments. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("args not array");
+	uint32_t arg_count = mp_decode_array(&args);
+	if (arg_count != 6)
+		return ERROR("invalid argument count: %d", arg_count);
+
+	/* Space ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("space ID not uint");
+	uint32_t space_id = mp_decode_uint(&args);
+
+	/* Search index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("index ID not uint");
+	uint32_t index_id = mp_decode_uint(&args);
+
+	/* Search index key_def. */
+	struct key_def_cache_entry *search_parts;
+	if (args_parse_index_parts_cached(&args, &search_parts) != 0)
+		return -1;
+
+	/* The from key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *from_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *from_key_end = args;
+
+	/* The until key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *until_key = args;
+	mp_next(&args); /* Skip the key. */
+	struct key_comparator until_cmp;
+	key_comparator_create(&until_cmp, search_parts, until_key);
+
+	/* The count of tuples to fetch ahead. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("lookahead not uint");
+	uint32_t lookahead = mp_decode_uint(&args);
+
+	/* That's it. */
+	if (args != args_end)
+		return ERROR("bigger input than expected");
+
+	/* The lookahead ring memory. */
+	size_t region_svp = box_region_used();
+	auto region_guard = make_scoped_guard([region_svp]() {
+		box_region_truncate(region_svp);
+	});
+
+	/* Create the search index iterator. */
+	box_iterator_t *it = box_index_iterator(space_id, index_id, ITER_GE,
+						from_key, from_key_end);
+	if (it == NULL)
+		return ERROR("couldn't create an iterator");
+	auto it_guard = make_scoped_guard([it]() { box_iterator_free(it); });
+
+	/* Fetch the tuples ahead of the processed ones. */
+	struct tuple_lookahead la;
+	if (tuple_lookahead_create(&la, it, lookahead,
+				   search_parts->fields[0]) != 0)
+		return -1;
+
+	/* Iterate over the space and process tuples. */
+	box_tuple_t *tuple;
+	for (;;) {
+		/* Get the next tuple. */
+		if (tuple_lookahead_next(&la, &tuple) != 0)
+			return ERROR("couldn't advance the iterator");
+		if (tuple == NULL)
+			return ERROR("unexpected end of space");
+
+		/* The until key reached - stop processing.*/
+		if (key_comparator_compare(&until_cmp, tuple) == 0)
+			break;
+
+		/* Process the tuple. */
+	}
+	return 0;
+}
+
+static int
+process_range_c_impl(box_function_ctx_t *ctx, const char *args,
+		     const char *args_end, bool use_batch)
+{
+	/* Parse the arguments. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("args not array");
+	uint32_t arg_count = mp_decode_array(&args);
+	if (arg_count != 4)
+		return ERROR("invalid argument count: %d", arg_count);
+
+	/* Space ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("space ID not uint");
+	uint32_t space_id = mp_decode_uint(&args);
+
+	/* Search index ID. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("index ID not uint");
+	uint32_t index_id = mp_decode_uint(&args);
+
+	/* The from key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *from_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *from_key_end = args;
+
+	/* The until key. */
+	if (mp_typeof(*args) != MP_ARRAY)
+		return ERROR("key is not array");
+	const char *until_key = args;
+	mp_next(&args); /* Skip the key. */
+	const char *until_key_end = args;
+
+	/* That's it. */
+	if (args != args_end)
+		return ERROR("bigger input than expected");
+
+	/*
+	 * Find the first tuple out of the range. The tuple pointers are
+	 * only stable if the engine returns the stored tuples (MemTX),
+	 * engines generating tuples on the fly can't be scanned this way.
+	 */
+	box_iterator_t *until_it = box_index_iterator(space_id, index_id,
+						      ITER_GE, until_key,
+						      until_key_end);
+	if (until_it == NULL)
+		return ERROR("couldn't create an iterator");
+	box_tuple_t *until_tuple;
+	int rc = box_iterator_next(until_it, &until_tuple);
+	if (rc == 0 && until_tuple != NULL)
+		box_tuple_ref(until_tuple);
+	box_iterator_free(until_it);
+	if (rc != 0)
+		return ERROR("couldn't find the range end");
+	auto until_tuple_guard = make_scoped_guard([until_tuple]() {
+		if (until_tuple != NULL)
+			box_tuple_unref(until_tuple);
+	});
+
+	/* Create the search index iterator. */
+	box_iterator_t *it = box_index_iterator(space_id, index_id, ITER_GE,
+						from_key, from_key_end);
+	if (it == NULL)
+		return ERROR("couldn't create an iterator");
+	auto it_guard = make_scoped_guard([it]() { box_iterator_free(it); });
+
+	/* Fetch the tuples one by one or by batches. */
+	struct tuple_fetcher fetcher;
+	if (tuple_fetcher_create(&fetcher, it, use_batch) != 0)
+		return -1;
+
+	/* Iterate over the space up to the range end tuple. */
+	box_tuple_t *tuple;
+	for (;;) {
+		/* Get the next tuple. */
+		if (tuple_fetcher_next(&fetcher, &tuple) != 0)
+			return ERROR("couldn't advance the iterator");
+
+		/* The range end reached - stop processing. */
+		if (tuple == until_tuple)
+			break;
+
+		/* The range end is before the range start. */
+		if (tuple == NULL)
+			return ERROR("unexpected end of space");
+
+		/* Process the tuple. */
+	}
+	return 0;
+}
+
+extern "C" int
+process_range_c(box_function_ctx_t *ctx, const char *args, const char *args_end)
+{
+	return process_range_c_impl(ctx, args, args_end, false);
+}
+
+/* Same as process_range_c, but iterates by box_iterator_next_batch. */
+extern "C" int
+process_range_c_next_batch(box_function_ctx_t *ctx, const char *args,
+			   const char *args_end)
+{
+	return process_range_c_impl(ctx, args, args_end, true);
+}
+
+/* The aggregate functions of the aggregate_until_c procedures. */
+enum aggregate_op {
+	AGGREGATE_COUNT,
+	AGGREGATE_SUM,
+	AGGREGATE_MIN,
+	AGGREGATE_MAX,
+	AGGREGATE_AVG,
+	aggregate_op_MAX,
+};
+
+static const char *aggregate_op_strs[] = {
+	/* [AGGREGATE_COUNT] = */ "count",
+	/* [AGGREGATE_SUM]   = */ "sum",
+	/* [AGGREGATE_MIN]   = */ "min",
+	/* [AGGREGATE_MAX]   = */ "max",
+	/* [AGGREGATE_AVG]   = */ "avg",
+};
+
+static_assert(lengthof(aggregate_op_strs) == aggregate_op_MAX,
+	      "Each aggregate must be present in aggregate_op_strs");
+
+/*
+ * The aggregate state, the nulls are skipped. The integers and the floating
+ * point values are accumulated separately, so the integer sum is exact if
+ * there are no floating point values in the range.
+ */
+struct aggregate {
+	uint64_t int_count;
+	int64_t int_sum;
+	/* Set if the integer sum has overflowed, it's invalid then. */
+	bool int_sum_overflow;
+	int64_t int_min;
+	int64_t int_max;
+	uint64_t double_count;
+	double double_sum;
+	double double_min;
+	double double_max;
+};
+
+static void
+aggregate_create(struct aggregate *agg)
+{
+	agg->int_count = 0;
+	agg->int_sum = 0;
+	agg->int_sum_overflow = false;
+	agg->int_min = INT64_MAX;
+	agg->int_max = INT64_MIN;
+	agg->double_count = 0;
+	agg->double_sum = 0;
+	agg->double_min = INFINITY;
+	agg->double_max = -INFINITY;
+}
+
+static inline void
+aggregate_add_int(struct aggregate *agg, int64_t value)
+{
+	agg->int_count++;
+	agg->int_sum_overflow |= __builtin_add_overflow(agg->int_sum, value,
+							&agg->int_sum);
+	agg->int_min = MIN(agg->int_min, value);
+	agg->int_max = MAX(agg->int_max, value);
+}
+
+static inline void
+aggregate_add_double(struct aggregate *agg, double value)
+{
+	agg->double_count++;
+	agg->double_sum += value;
+	agg->double_min = MIN(agg->double_min, value);
+	agg->double_max = MAX(agg->double_max, value);
+}
+
+/* The unsigned values out of the int64 range are accumulated as double. */
+static inline void
+aggregate_add_uint(struct aggregate *agg, uint64_t value)
+{
+	if (value <= INT64_MAX)
+		aggregate_add_int(agg, value);
+	else
+		aggregate_add_double(agg, value);
+}
+
+/* Add the values aggregated elsewhere (by a column kernel). */
+static void
+aggregate_merge_int(struct aggregate *agg, uint64_t count, int64_t sum,
+		    int64_t min, int64_t max)
+{
+	agg->int_count += count;
+	agg->int_sum_overflow |= __builtin_add_overflow(agg->int_sum, sum,
+							&agg->int_sum);
+	agg->int_min = MIN(agg->int_min, min);
+	agg->int_max = MAX(agg->int_max, max);
+}
+
+/* Same as aggregate_merge_int, but the sum may be out of the int64 range. */
+static void
+aggregate_merge_int128(struct aggregate *agg, uint64_t count, __int128 sum,
+		       int64_t min, int64_t max)
+{
+	if (sum < INT64_MIN || sum > INT64_MAX) {
+		agg->int_sum_overflow = true;
+		sum = 0;
+	}
+	aggregate_merge_int(agg, count, (int64_t)sum, min, max);
+}
+
+/* Add the floating point values aggregated elsewhere. */
+static void
+aggregate_merge_double(struct aggregate *agg, uint64_t count, double sum,
+		       double min, double max)
+{
+	agg->double_count += count;
+	agg->double_sum += sum;
+	agg->double_min = MIN(agg->double_min, min);
+	agg->double_max = MAX(agg->double_max, max);
+}
+
+/* Add the msgpack field value, NULL is an absent field (null). */
+static inline int
+aggregate_add_field(struct aggregate *agg, const char *field)
+{
+	if (field == NULL)
+		return 0;
+	switch (mp_typeof(*field)) {
+	case MP_UINT:
+		aggregate_add_uint(agg, mp_decode_uint(&field));
+		return 0;
+	case MP_INT:
+		aggregate_add_int(agg, mp_decode_int(&field));
+		return 0;
+	case MP_DOUBLE:
+		aggregate_add_double(agg, mp_decode_double(&field));
+		return 0;
+	case MP_FLOAT:
+		aggregate_add_double(agg, mp_decode_float(&field));
+		return 0;
+	case MP_NIL:
+		return 0;
+	default:
+		return ERROR("aggregated field is not a number");
+	}
+}
+
+/*
+ * Return the aggregate: count is unsigned, avg is double, sum, min and max
+ * are integers if there are no floating point values in the range. Empty
+ * range min, max and avg are nil.
+ */
+static int
+aggregate_return(box_function_ctx_t *ctx, const struct aggregate *agg,
+		 enum aggregate_op op)
+{
+	uint64_t count = agg->int_count + agg->double_count;
+	bool is_double = agg->double_count != 0;
+	if ((op == AGGREGATE_SUM || op == AGGREGATE_AVG) &&
+	    agg->int_sum_overflow)
+		return ERROR("integer overflow in %s", aggregate_op_strs[op]);
+	double sum = agg->double_sum + (double)agg->int_sum;
+	double min = MIN(agg->double_min, agg->int_count == 0 ? INFINITY :
+					  (double)agg->int_min);
+	double max = MAX(agg->double_max, agg->int_count == 0 ? -INFINITY :
+					  (double)agg->int_max);
+	char buf[16];
+	char *data = buf;
+	if (count == 0 && op != AGGREGATE_COUNT && op != AGGREGATE_SUM) {
+		data = mp_encode_nil(data);
+		return box_return_mp(ctx, buf, data);
+	}
+	switch (op) {
+	case AGGREGATE_COUNT:
+		data = mp_encode_uint(data, count);
+		break;
+	case AGGREGATE_SUM:
+		data = is_double ? mp_encode_double(data, sum) :
+				   mp_encode_arrow_value(data, agg->int_sum);
+		break;
+	case AGGREGATE_MIN:
+		data = is_double ? mp_encode_double(data, min) :
+				   mp_encode_arrow_value(data, agg->int_min);
+		break;
+	case AGGREGATE_MAX:
+		data = is_double ? mp_encode_double(data, max) :
+				   mp_encode_arrow_value(data, agg->int_max);
+		break;
+	case AGGREGATE_AVG:
+		data = mp_encode_double(data, sum / count);
+		break;
+	default:
+		assert(false);
+	}
+	return box_return_mp(ctx, buf, data);
+}
+
+static int
+args_parse_aggregate_op(const char **args, enum aggregate_op *op)
+{
+	if (mp_typeof(**args) != MP_STR)
+		return ERROR("aggregate not str");
+	uint32_t len;
+	const char *str = mp_decode_str(args, &len);
+	*op = (enum aggregate_op)strnindex(aggregate_op_strs, str, len,
+					   aggregate_op_MAX);
+	if (*op == aggregate_op_MAX)
+		return ERROR("unknown aggregate: %.*s", len, str);
+	return 0;
+}
+
+/*
+ * Aggregate a numeric field over a range. The tuples are borrowed if the
+ * BOX_ITER_NOREF iterator is supported: the loop doesn't yield.
+ */
+extern "C" int
+aggregate_until_c(box_function_ctx_t *ctx, const char *args,
+		  const char *args_end)
+{
+	/* Parse the arguments. */
+	if (mp_typeof(*args) != MP_ARRAY)
 		return ERROR("args not array");
 	uint32_t arg_count = mp_decode_array(&args);
 	if (arg_count != 7)
@@ -413,16 +3354,10 @@ delete_until_c_nocmp_batched(box_function_ctx_t *ctx,
 		return ERROR("index ID not uint");
 	uint32_t index_id = mp_decode_uint(&args);
 
-	/* Write index ID. */
-	if (mp_typeof(*args) != MP_UINT)
-		return ERROR("write index ID not uint");
-	uint32_t write_index_id = mp_decode_uint(&args);
-
 	/* Search index key_def. */
-	box_key_def_t *kd;
-	if (args_parse_key_def(&args, &kd) != 0)
+	struct key_def_cache_entry *search_parts;
+	if (args_parse_index_parts_cached(&args, &search_parts) != 0)
 		return -1;
-	auto kd_guard = make_scoped_guard([kd]() { box_key_def_delete(kd); });
 
 	/* The from key. */
 	if (mp_typeof(*args) != MP_ARRAY)
@@ -436,95 +3371,366 @@ delete_until_c_nocmp_batched(box_function_ctx_t *ctx,
 		return ERROR("key is not array");
 	const char *until_key = args;
 	mp_next(&args); /* Skip the key. */
-	const char *until_key_end = args;
+	struct key_comparator until_cmp;
+	key_comparator_create(&until_cmp, search_parts, until_key);
 
-	/* The delete batch size. */
+	/* The aggregated field number. */
 	if (mp_typeof(*args) != MP_UINT)
-		return ERROR("batch size not uint");
-	uint32_t batch_size = mp_decode_uint(&args);
+		return ERROR("field number not uint");
+	uint32_t field_no = mp_decode_uint(&args);
+
+	/* The aggregate. */
+	enum aggregate_op op;
+	if (args_parse_aggregate_op(&args, &op) != 0)
+		return -1;
 
 	/* That's it. */
 	if (args != args_end)
 		return ERROR("bigger input than expected");
 
-	/* Get the amount to delete. */
-	ssize_t rows_remained = box_index_count(space_id, index_id, ITER_LT,
-						until_key, until_key_end);
-	if (rows_remained < 0)
-		return ERROR("can't count the amount to delete");
-
-	/* Allocate the deletion key buffer. */
-	size_t region_svp = box_region_used();
-	auto region_guard = make_scoped_guard([region_svp]() {
-		box_region_truncate(region_svp);
-	});
-	char **keys = (char **)box_region_alloc(batch_size * sizeof(*keys));
-	char **key_ends =
-		(char **)box_region_alloc(batch_size * sizeof(*key_ends));
-	int keys_size = 0;
-
-	/* Next memory is for the extracted keys. */
-	size_t region_keys_svp = box_region_used();
-
 	/* Create the search index iterator. */
-	box_iterator_t *it = box_index_iterator(space_id, index_id, ITER_GE,
-						from_key, from_key_end);
+	box_iterator_t *it;
+	if (box_index_iterator_ex != NULL) {
+		it = box_index_iterator_ex(space_id, index_id, ITER_GE,
+					   from_key, from_key_end,
+					   BOX_ITER_NOREF);
+	} else {
+		it = box_index_iterator(space_id, index_id, ITER_GE,
+					from_key, from_key_end);
+	}
 	if (it == NULL)
 		return ERROR("couldn't create an iterator");
 	auto it_guard = make_scoped_guard([it]() { box_iterator_free(it); });
 
-	/* Iterate over the space and delete tuple batches. */
+	/* Aggregate the field up to the until key or the end of space. */
+	struct aggregate agg;
+	aggregate_create(&agg);
 	box_tuple_t *tuple;
-	while (rows_remained) {
-		/* Get the next tuple. */
+	for (;;) {
 		if (box_iterator_next(it, &tuple) != 0)
 			return ERROR("couldn't advance the iterator");
 		if (tuple == NULL)
-			return ERROR("unexpected end of space");
+			break;
+		if (key_comparator_compare(&until_cmp, tuple) == 0)
+			break;
+		if (aggregate_add_field(&agg,
+					box_tuple_field(tuple, field_no)) != 0)
+			return -1;
+	}
+	return aggregate_return(ctx, &agg, op);
+}
 
-		/* Extract the tuple key and save it. */
-		uint32_t key_size;
-		char *key = box_tuple_extract_key(tuple, space_id,
-						  write_index_id, &key_size);
-		if (key == NULL)
-			return ERROR("couldn't extract key from tuple");
-		keys[keys_size] = key;
-		key_ends[keys_size++] = key + key_size;
-		rows_remained--;
+/* Aggregate the values one by one, checking the sum overflow. */
+template <typename T>
+static void
+arrow_values_aggregate_scalar(const T *values, int64_t count,
+			      struct aggregate *agg)
+{
+	for (int64_t i = 0; i < count; i++) {
+		if (std::is_floating_point<T>::value)
+			aggregate_add_double(agg, values[i]);
+		else if (std::is_signed<T>::value)
+			aggregate_add_int(agg, values[i]);
+		else
+			aggregate_add_uint(agg, values[i]);
+	}
+}
 
-		/* Delete the batch if collected enough. */
-		if (keys_size == batch_size) {
-			for (int i = 0; i < batch_size; i++) {
-				if (box_delete(space_id, write_index_id,
-					       keys[i], key_ends[i],
-					       &tuple) != 0) {
-					return ERROR("couldn't delete a tuple");
-				}
-			}
-			keys_size = 0;
-			box_region_truncate(region_keys_svp);
+/*
+ * Aggregate the values of a fixed-width Arrow column with no nulls. The
+ * narrow integers can't overflow the int64 sum of a batch, so they're
+ * aggregated by a branchless loop the compiler vectorizes. The 64-bit
+ * and the floating point columns have their own kernels below.
+ */
+template <typename T>
+static void
+arrow_values_aggregate(const T *values, int64_t count, struct aggregate *agg)
+{
+	static_assert(std::is_integral<T>::value && sizeof(T) < sizeof(int64_t),
+		      "The wide columns have specialized kernels");
+	if (count == 0 || count > INT32_MAX) {
+		arrow_values_aggregate_scalar(values, count, agg);
+		return;
+	}
+	int64_t sum = 0;
+	T min = values[0];
+	T max = values[0];
+	for (int64_t i = 0; i < count; i++) {
+		sum += values[i];
+		min = values[i] < min ? values[i] : min;
+		max = values[i] > max ? values[i] : max;
+	}
+	aggregate_merge_int(agg, count, sum, min, max);
+}
+
+/*
+ * Count of the independent accumulators of the wide kernels. The lanes
+ * are vectorized as is, without reassociating the sums.
+ */
+#define AGGREGATE_LANES 4
+
+/*
+ * Sum, min and max of the 64-bit values xored with the bias: 0 for the
+ * uint64 values, the sign bit for the int64 ones (it maps them to uint64
+ * keeping the order). The sum is taken by the 32-bit halves of the values,
+ * it can't overflow for up to INT32_MAX values, so the result is exact.
+ */
+static inline __attribute__((always_inline)) void
+u64_values_reduce_impl(const uint64_t *values, int64_t count, uint64_t bias,
+		       unsigned __int128 *sum, uint64_t *min, uint64_t *max)
+{
+	uint64_t sum_lo[AGGREGATE_LANES] = {};
+	uint64_t sum_hi[AGGREGATE_LANES] = {};
+	uint64_t lane_min[AGGREGATE_LANES];
+	uint64_t lane_max[AGGREGATE_LANES];
+	for (int j = 0; j < AGGREGATE_LANES; j++) {
+		lane_min[j] = UINT64_MAX;
+		lane_max[j] = 0;
+	}
+	int64_t i = 0;
+	for (; i + AGGREGATE_LANES <= count; i += AGGREGATE_LANES) {
+		for (int j = 0; j < AGGREGATE_LANES; j++) {
+			uint64_t value = values[i + j] ^ bias;
+			sum_lo[j] += value & UINT32_MAX;
+			sum_hi[j] += value >> 32;
+			lane_min[j] = value < lane_min[j] ? value : lane_min[j];
+			lane_max[j] = value > lane_max[j] ? value : lane_max[j];
 		}
 	}
+	for (; i < count; i++) {
+		uint64_t value = values[i] ^ bias;
+		sum_lo[0] += value & UINT32_MAX;
+		sum_hi[0] += value >> 32;
+		lane_min[0] = MIN(lane_min[0], value);
+		lane_max[0] = MAX(lane_max[0], value);
+	}
+	*sum = 0;
+	*min = UINT64_MAX;
+	*max = 0;
+	for (int j = 0; j < AGGREGATE_LANES; j++) {
+		*sum += ((unsigned __int128)sum_hi[j] << 32) + sum_lo[j];
+		*min = MIN(*min, lane_min[j]);
+		*max = MAX(*max, lane_max[j]);
+	}
+}
 
-	/* Handle the remained collected keys not forming a full batch. */
-	for (int i = 0; i < keys_size; i++) {
-		if (box_delete(space_id, write_index_id, keys[i],
-			       key_ends[i], &tuple) != 0) {
-			return ERROR("couldn't delete a tuple in tail");
+#if defined(__x86_64__)
+/*
+ * The baseline x86_64 has no 64-bit vector comparisons, so the min and the
+ * max only vectorize with AVX2.
+ */
+__attribute__((target("avx2")))
+static void
+u64_values_reduce_avx2(const uint64_t *values, int64_t count, uint64_t bias,
+		       unsigned __int128 *sum, uint64_t *min, uint64_t *max)
+{
+	u64_values_reduce_impl(values, count, bias, sum, min, max);
+}
+#endif /* defined(__x86_64__) */
+
+static void
+u64_values_reduce(const uint64_t *values, int64_t count, uint64_t bias,
+		  unsigned __int128 *sum, uint64_t *min, uint64_t *max)
+{
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		u64_values_reduce_avx2(values, count, bias, sum, min, max);
+		return;
+	}
+#endif
+	u64_values_reduce_impl(values, count, bias, sum, min, max);
+}
+
+template <>
+void
+arrow_values_aggregate<int64_t>(const int64_t *values, int64_t count,
+				struct aggregate *agg)
+{
+	if (count == 0 || count > INT32_MAX) {
+		arrow_values_aggregate_scalar(values, count, agg);
+		return;
+	}
+	const uint64_t bias = 1ull << 63;
+	unsigned __int128 biased_sum;
+	uint64_t min, max;
+	u64_values_reduce((const uint64_t *)values, count, bias, &biased_sum,
+			  &min, &max);
+	__int128 sum = (__int128)biased_sum - ((__int128)count << 63);
+	aggregate_merge_int128(agg, count, sum, (int64_t)(min ^ bias),
+			       (int64_t)(max ^ bias));
+}
+
+/*
+ * The uint64 values above INT64_MAX are accumulated as double (see
+ * aggregate_add_uint), such batches are aggregated one by one.
+ */
+template <>
+void
+arrow_values_aggregate<uint64_t>(const uint64_t *values, int64_t count,
+				 struct aggregate *agg)
+{
+	if (count == 0 || count > INT32_MAX) {
+		arrow_values_aggregate_scalar(values, count, agg);
+		return;
+	}
+	unsigned __int128 sum;
+	uint64_t min, max;
+	u64_values_reduce(values, count, 0, &sum, &min, &max);
+	if (max > INT64_MAX) {
+		arrow_values_aggregate_scalar(values, count, agg);
+		return;
+	}
+	aggregate_merge_int128(agg, count, (__int128)sum, min, max);
+}
+
+/* The floating point values are summed as double by each lane. */
+template <typename T>
+static void
+float_values_aggregate(const T *values, int64_t count, struct aggregate *agg)
+{
+	double lane_sum[AGGREGATE_LANES] = {};
+	double lane_min[AGGREGATE_LANES];
+	double lane_max[AGGREGATE_LANES];
+	for (int j = 0; j < AGGREGATE_LANES; j++) {
+		lane_min[j] = INFINITY;
+		lane_max[j] = -INFINITY;
+	}
+	int64_t i = 0;
+	for (; i + AGGREGATE_LANES <= count; i += AGGREGATE_LANES) {
+		for (int j = 0; j < AGGREGATE_LANES; j++) {
+			double value = values[i + j];
+			lane_sum[j] += value;
+			lane_min[j] = MIN(lane_min[j], value);
+			lane_max[j] = MAX(lane_max[j], value);
 		}
 	}
-	return 0;
+	for (; i < count; i++) {
+		double value = values[i];
+		lane_sum[0] += value;
+		lane_min[0] = MIN(lane_min[0], value);
+		lane_max[0] = MAX(lane_max[0], value);
+	}
+	double sum = 0;
+	double min = INFINITY;
+	double max = -INFINITY;
+	for (int j = 0; j < AGGREGATE_LANES; j++) {
+		sum += lane_sum[j];
+		min = MIN(min, lane_min[j]);
+		max = MAX(max, lane_max[j]);
+	}
+	aggregate_merge_double(agg, count, sum, min, max);
+}
+
+template <>
+void
+arrow_values_aggregate<float>(const float *values, int64_t count,
+			      struct aggregate *agg)
+{
+	float_values_aggregate(values, count, agg);
+}
+
+template <>
+void
+arrow_values_aggregate<double>(const double *values, int64_t count,
+			       struct aggregate *agg)
+{
+	float_values_aggregate(values, count, agg);
+}
+
+/* Aggregate the first count values of a fixed-width Arrow column. */
+template <typename T>
+static void
+arrow_column_aggregate(const struct ArrowArray *column, int64_t count,
+		       struct aggregate *agg)
+{
+	const T *values = (const T *)column->buffers[1] + column->offset;
+	if (!arrow_column_has_nulls(column)) {
+		arrow_values_aggregate(values, count, agg);
+		return;
+	}
+	for (int64_t i = 0; i < count; i++) {
+		if (arrow_column_is_null(column, i))
+			continue;
+		arrow_values_aggregate(&values[i], 1, agg);
+	}
+}
+
+typedef void
+(*arrow_column_aggregate_f)(const struct ArrowArray *column, int64_t count,
+			    struct aggregate *agg);
+
+/*
+ * Get the kernel by the Arrow format string of the column, returns NULL
+ * if the column is not numeric.
+ */
+static arrow_column_aggregate_f
+arrow_column_aggregate_by_format(const char *format)
+{
+	if (format == NULL || format[0] == '\0' || format[1] != '\0')
+		return NULL;
+	switch (format[0]) {
+	case 'c':
+		return arrow_column_aggregate<int8_t>;
+	case 'C':
+		return arrow_column_aggregate<uint8_t>;
+	case 's':
+		return arrow_column_aggregate<int16_t>;
+	case 'S':
+		return arrow_column_aggregate<uint16_t>;
+	case 'i':
+		return arrow_column_aggregate<int32_t>;
+	case 'I':
+		return arrow_column_aggregate<uint32_t>;
+	case 'l':
+		return arrow_column_aggregate<int64_t>;
+	case 'L':
+		return arrow_column_aggregate<uint64_t>;
+	case 'f':
+		return arrow_column_aggregate<float>;
+	case 'g':
+		return arrow_column_aggregate<double>;
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Count the rows of the [from, until) range of the index, the empty from
+ * key is the index start. Returns -1 on error.
+ */
+static ssize_t
+index_range_row_count(uint32_t space_id, uint32_t index_id,
+		      const char *from_key, const char *from_key_end,
+		      const char *until_key, const char *until_key_end)
+{
+	ssize_t count = box_index_count(space_id, index_id, ITER_LT,
+					until_key, until_key_end);
+	if (count < 0)
+		return ERROR("can't count the range rows");
+	const char *from_key_parts = from_key;
+	if (mp_decode_array(&from_key_parts) == 0)
+		return count;
+	ssize_t count_before = box_index_count(space_id, index_id, ITER_LT,
+					       from_key, from_key_end);
+	if (count_before < 0)
+		return ERROR("can't count the range rows");
+	return MAX(count - count_before, 0);
 }
 
+/*
+ * Same as aggregate_until_c, but the column is read from the Arrow stream
+ * of a MemCS index. The range row count is looked up in advance like in the
+ * delete_until_c_nocmp_arrow, so the search key parts are not passed.
+ */
 extern "C" int
-delete_until_c_nocmp_arrow(box_function_ctx_t *ctx,
-			   const char *args, const char *args_end)
+aggregate_until_c_arrow(box_function_ctx_t *ctx, const char *args,
+			const char *args_end)
 {
 	/* Parse the arguments. */
 	if (mp_typeof(*args) != MP_ARRAY)
 		return ERROR("args not array");
 	uint32_t arg_count = mp_decode_array(&args);
-	if (arg_count != 8)
+	if (arg_count != 6)
 		return ERROR("invalid argument count: %d", arg_count);
 
 	/* Space ID. */
@@ -537,26 +3743,6 @@ delete_until_c_nocmp_arrow(box_function_ctx_t *ctx,
 		return ERROR("index ID not uint");
 	uint32_t index_id = mp_decode_uint(&args);
 
-	/* Write index ID. */
-	if (mp_typeof(*args) != MP_UINT)
-		return ERROR("write index ID not uint");
-	uint32_t write_index_id = mp_decode_uint(&args);
-
-	/* Search index key_def. */
-	box_key_def_t *kd;
-	if (args_parse_key_def(&args, &kd) != 0)
-		return -1;
-	auto kd_guard = make_scoped_guard([kd]() { box_key_def_delete(kd); });
-
-	/* Write index parts. */
-	uint32_t *fields, *types, part_count;
-	if (args_parse_index_parts(&args, &fields, &types, &part_count) != 0)
-		return -1;
-	auto parts_guard = make_scoped_guard([fields, types]() {
-		free(fields);
-		free(types);
-	});
-
 	/* The from key. */
 	if (mp_typeof(*args) != MP_ARRAY)
 		return ERROR("key is not array");
@@ -571,31 +3757,36 @@ delete_until_c_nocmp_arrow(box_function_ctx_t *ctx,
 	mp_next(&args); /* Skip the key. */
 	const char *until_key_end = args;
 
-	/* The delete batch size. */
+	/* The aggregated field number. */
 	if (mp_typeof(*args) != MP_UINT)
-		return ERROR("batch size not uint");
-	uint32_t batch_size = mp_decode_uint(&args);
+		return ERROR("field number not uint");
+	uint32_t field_no = mp_decode_uint(&args);
+
+	/* The aggregate. */
+	enum aggregate_op op;
+	if (args_parse_aggregate_op(&args, &op) != 0)
+		return -1;
 
 	/* That's it. */
 	if (args != args_end)
 		return ERROR("bigger input than expected");
 
-	/* Get the amount to delete. */
-	ssize_t rows_remained = box_index_count(space_id, index_id, ITER_LT,
-						until_key, until_key_end);
+	/* Get the range row count. */
+	ssize_t rows_remained = index_range_row_count(space_id, index_id,
+						      from_key, from_key_end,
+						      until_key, until_key_end);
 	if (rows_remained < 0)
-		return ERROR("can't count the amount to delete");
+		return -1;
 
-	/* Create the search index scanner. */
+	/* Create the search index scanner of the field. */
 	struct ArrowArrayStream stream = {};
 	box_arrow_options_t *options = box_arrow_options_new();
 	auto arrow_options_guard = make_scoped_guard([options]() {
 		box_arrow_options_delete(options);
 	});
 	box_arrow_options_set_iterator(options, ITER_GE);
-	box_arrow_options_set_batch_row_count(options, batch_size);
-	if (box_index_arrow_stream(space_id, index_id, part_count,
-				   fields, from_key, from_key_end,
+	if (box_index_arrow_stream(space_id, index_id, 1, &field_no,
+				   from_key, from_key_end,
 				   options, &stream) != 0)
 		return ERROR("couldn't create an Arrow stream");
 	auto it_guard = make_scoped_guard([&stream]() {
@@ -603,59 +3794,95 @@ delete_until_c_nocmp_arrow(box_function_ctx_t *ctx,
 			stream.release(&stream);
 	});
 
-	/* Scan the write index part batches and delete the rows. */
-	for (;;) {
-		size_t region_svp = box_region_used();
-		auto region_guard = make_scoped_guard([region_svp]() {
-			box_region_truncate(region_svp);
-		});
+	/* Choose the kernel by the column type. */
+	struct ArrowSchema schema = {};
+	if (stream.get_schema(&stream, &schema) != 0)
+		return ERROR("couldn't get the stream schema");
+	auto schema_guard = make_scoped_guard([&schema]() {
+		if (schema.release != NULL)
+			schema.release(&schema);
+	});
+	if (schema.n_children != 1)
+		return ERROR("unexpected n_children: %lld",
+			     (long long)schema.n_children);
+	arrow_column_aggregate_f column_aggregate =
+		arrow_column_aggregate_by_format(schema.children[0]->format);
+	if (column_aggregate == NULL)
+		return ERROR("aggregated field is not a number: %s",
+			     schema.children[0]->format);
 
-		/* Get the next batch. */
-		struct ArrowArray array;
+	/* Aggregate the column batches. */
+	struct aggregate agg;
+	aggregate_create(&agg);
+	while (rows_remained > 0) {
+		struct ArrowArray array = {};
 		if (stream.get_next(&stream, &array) != 0)
 			return ERROR("couldn't read the next stream batch");
-		if (array.n_children == 0)
+		auto array_guard = make_scoped_guard([&array]() {
+			if (array.release != NULL)
+				array.release(&array);
+		});
+		if (array.release == NULL || array.n_children == 0)
 			break; /* End of data. */
-		if (array.n_children != part_count)
-			return ERROR("unexpected n_children: %d", array.n_children);
+		if (array.n_children != 1)
+			return ERROR("unexpected n_children: %lld",
+				     (long long)array.n_children);
+		if (array.offset != 0)
+			return ERROR("sliced batches are not supported");
+		int64_t count = MIN(array.length, rows_remained);
+		column_aggregate(array.children[0], count, &agg);
+		rows_remained -= count;
+	}
+	return aggregate_return(ctx, &agg, op);
+}
 
-		/* Transpose the batch (get msgpack keys). */
-		int key_count = MIN(array.length, rows_remained);
-		char **keys = (char **)malloc(sizeof(*keys) * key_count);
-		if (keys == NULL)
-			return ERROR("can't allocate a key batch");
-		arrow_array_transpose(&array, types, key_count, keys);
+/*
+ * The chunk of the select_until_c tuples. Reused between the calls, so the
+ * memory taken is bounded by the largest chunk requested.
+ */
+struct select_chunk {
+	char *data;
+	size_t size;
+	size_t capacity;
+};
+
+static struct select_chunk select_chunk;
 
-		/* Drop the keys. */
-		for (int i = 0; i < key_count; i++) {
-			char *key = keys[i];
-			const char *key_end = key;
-			mp_next(&key_end);
-			box_tuple_t *dummy;
-			if (box_delete(space_id, write_index_id,
-				       key, key_end, &dummy) != 0) {
-				return ERROR("couldn't delete a tuple");
-			}
-		}
-		rows_remained -= key_count;
+/*
+ * The chunk begins with the room for the largest array header, the actual
+ * header is written right before the tuples once their count is known.
+ */
+#define SELECT_CHUNK_HEADER_SIZE_MAX 5
 
-		/* Free the keys. */
-		for (int i = 0; i < key_count; i++)
-			free(keys[i]);
-		free(keys);
-	}
+static int
+select_chunk_reserve(struct select_chunk *chunk, size_t size)
+{
+	if (chunk->size + size <= chunk->capacity)
+		return 0;
+	size_t capacity = MAX(chunk->capacity * 2, chunk->size + size);
+	char *data = (char *)realloc(chunk->data, capacity);
+	if (data == NULL)
+		return ERROR("can't allocate the select chunk");
+	chunk->data = data;
+	chunk->capacity = capacity;
 	return 0;
 }
 
+/*
+ * Select a range by chunks: each call returns up to row_limit tuples of
+ * up to byte_limit bytes total (but at least one tuple) as a single
+ * msgpack array and the position to continue after (nil if the range is
+ * over). The position is passed back as the after argument to get the
+ * next chunk.
+ */
 extern "C" int
-update_until_c_naive(box_function_ctx_t *ctx,
-		     const char *args, const char *args_end)
+select_until_c(box_function_ctx_t *ctx, const char *args, const char *args_end)
 {
 	/* Parse the arguments. */
 	if (mp_typeof(*args) != MP_ARRAY)
 		return ERROR("args not array");
 	uint32_t arg_count = mp_decode_array(&args);
-	if (arg_count != 7)
+	if (arg_count != 8)
 		return ERROR("invalid argument count: %d", arg_count);
 
 	/* Space ID. */
@@ -668,23 +3895,10 @@ update_until_c_naive(box_function_ctx_t *ctx,
 		return ERROR("index ID not uint");
 	uint32_t index_id = mp_decode_uint(&args);
 
-	/* Write index ID. */
-	if (mp_typeof(*args) != MP_UINT)
-		return ERROR("write index ID not uint");
-	uint32_t write_index_id = mp_decode_uint(&args);
-
 	/* Search index key_def. */
-	box_key_def_t *kd;
-	if (args_parse_key_def(&args, &kd) != 0)
+	struct key_def_cache_entry *search_parts;
+	if (args_parse_index_parts_cached(&args, &search_parts) != 0)
 		return -1;
-	auto kd_guard = make_scoped_guard([kd]() { box_key_def_delete(kd); });
-
-	/* Update ops. */
-	if (mp_typeof(*args) != MP_ARRAY)
-		return ERROR("non-array update ops");
-	const char *ops = args;
-	mp_next(&args); /* Skip the options without checking. */
-	const char *ops_end = args;
 
 	/* The from key. */
 	if (mp_typeof(*args) != MP_ARRAY)
@@ -698,59 +3912,159 @@ update_until_c_naive(box_function_ctx_t *ctx,
 		return ERROR("key is not array");
 	const char *until_key = args;
 	mp_next(&args); /* Skip the key. */
+	struct key_comparator until_cmp;
+	key_comparator_create(&until_cmp, search_parts, until_key);
+
+	/* The chunk limits. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("row limit not uint");
+	uint64_t row_limit = mp_decode_uint(&args);
+	if (row_limit == 0)
+		return ERROR("row limit is zero");
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("byte limit not uint");
+	uint64_t byte_limit = mp_decode_uint(&args);
+
+	/* The position to continue after (nil to start from the from key). */
+	const char *after = NULL;
+	uint32_t after_size = 0;
+	if (mp_typeof(*args) == MP_STR)
+		after = mp_decode_str(&args, &after_size);
+	else if (mp_typeof(*args) == MP_BIN)
+		after = mp_decode_bin(&args, &after_size);
+	else if (mp_typeof(*args) == MP_NIL)
+		mp_decode_nil(&args);
+	else
+		return ERROR("after position not str, bin or nil");
 
 	/* That's it. */
 	if (args != args_end)
 		return ERROR("bigger input than expected");
 
 	/* Create the search index iterator. */
-	box_iterator_t *it = box_index_iterator(space_id, index_id, ITER_GE,
-						from_key, from_key_end);
+	box_iterator_t *it;
+	if (after == NULL) {
+		it = box_index_iterator(space_id, index_id, ITER_GE,
+					from_key, from_key_end);
+	} else {
+		it = box_index_iterator_after(space_id, index_id, ITER_GE,
+					      from_key, from_key_end,
+					      after, after + after_size);
+	}
 	if (it == NULL)
 		return ERROR("couldn't create an iterator");
 	auto it_guard = make_scoped_guard([it]() { box_iterator_free(it); });
 
-	/* Iterate over the space and update tuples. */
-	box_tuple_t *tuple;
+	/* Copy the tuples to the chunk. */
+	struct select_chunk *chunk = &select_chunk;
+	chunk->size = 0;
+	if (select_chunk_reserve(chunk, SELECT_CHUNK_HEADER_SIZE_MAX) != 0)
+		return -1;
+	chunk->size = SELECT_CHUNK_HEADER_SIZE_MAX;
+	uint64_t row_count = 0;
+	size_t last_offset = 0;
+	bool is_over = false;
 	for (;;) {
-		/* Savepoint memory for the extracted key. */
-		size_t region_svp = box_region_used();
-		auto region_guard = make_scoped_guard([region_svp]() {
-			box_region_truncate(region_svp);
-		});
-
-		/* Get the next tuple. */
+		box_tuple_t *tuple;
 		if (box_iterator_next(it, &tuple) != 0)
 			return ERROR("couldn't advance the iterator");
-		if (tuple == NULL)
-			return ERROR("unexpected end of space");
-
-		/* The until key reached - stop update.*/
-		if (box_tuple_compare_with_key(tuple, until_key, kd) == 0)
+		if (tuple == NULL ||
+		    key_comparator_compare(&until_cmp, tuple) == 0) {
+			is_over = true;
+			break;
+		}
+		size_t bsize = box_tuple_bsize(tuple);
+		size_t byte_count = chunk->size - SELECT_CHUNK_HEADER_SIZE_MAX;
+		if (row_count == row_limit ||
+		    (row_count != 0 && byte_count + bsize > byte_limit))
 			break;
+		if (select_chunk_reserve(chunk, bsize) != 0)
+			return -1;
+		last_offset = chunk->size;
+		chunk->size += box_tuple_to_buf(tuple, chunk->data + chunk->size,
+						bsize);
+		row_count++;
+	}
 
-		/* Update the tuple. */
-		uint32_t key_size;
-		char *key = box_tuple_extract_key(tuple, space_id,
-						  write_index_id, &key_size);
-		if (key == NULL)
-			return ERROR("couldn't extract key from tuple");
-		if (box_update(space_id, write_index_id, key, key + key_size,
-			       ops, ops_end, 1, &tuple) != 0)
-			return ERROR("couldn't update a tuple");
+	/* Return the tuples. */
+	char *header = chunk->data + SELECT_CHUNK_HEADER_SIZE_MAX -
+		       mp_sizeof_array(row_count);
+	mp_encode_array(header, row_count);
+	if (box_return_mp(ctx, header, chunk->data + chunk->size) != 0)
+		return -1;
+
+	/* Return the position of the last tuple to continue after. */
+	if (is_over) {
+		char nil[1];
+		return box_return_mp(ctx, nil, mp_encode_nil(nil));
 	}
-	return 0;
+	const char *pos, *pos_end;
+	if (box_index_tuple_position(space_id, index_id,
+				     chunk->data + last_offset,
+				     chunk->data + chunk->size,
+				     &pos, &pos_end) != 0)
+		return ERROR("couldn't get the tuple position");
+	uint32_t pos_size = pos_end - pos;
+	char *data = (char *)box_region_alloc(mp_sizeof_bin(pos_size));
+	if (data == NULL)
+		return ERROR("can't allocate the position");
+	char *data_end = mp_encode_bin(data, pos, pos_size);
+	return box_return_mp(ctx, data, data_end);
+}
+
+/*
+ * The Arrow IPC messages of select_columns_until_c. Reused between the
+ * calls, so the memory taken is bounded by the largest message.
+ */
+static struct arrow_ipc_writer select_columns_writer;
+
+/* The messages begin with the room for the largest bin header. */
+#define SELECT_COLUMNS_HEADER_SIZE_MAX 5
+
+static void
+select_columns_message_begin(struct arrow_ipc_writer *writer)
+{
+	writer->out.size = 0;
+	arrow_ipc_buf_grow(&writer->out, SELECT_COLUMNS_HEADER_SIZE_MAX);
+}
+
+/* Return the message written as a msgpack bin. */
+static int
+select_columns_message_return(box_function_ctx_t *ctx,
+			      struct arrow_ipc_writer *writer)
+{
+	if (writer->out.size < SELECT_COLUMNS_HEADER_SIZE_MAX)
+		return ERROR("can't allocate the Arrow IPC message");
+	uint32_t size = writer->out.size - SELECT_COLUMNS_HEADER_SIZE_MAX;
+	char *header = writer->out.data + SELECT_COLUMNS_HEADER_SIZE_MAX -
+		       mp_sizeof_binl(size);
+	mp_encode_binl(header, size);
+	return box_return_mp(ctx, header, writer->out.data + writer->out.size);
 }
 
+/*
+ * Select the fields of a range of a MemCS index as Arrow IPC by chunks:
+ * each call returns up to batch_limit record batch messages as msgpack
+ * bins and the key to continue after (nil if the range is over). The key
+ * is passed back as the after argument to get the next chunk. The first
+ * call also returns the schema message before the batches and the last
+ * one the end of stream marker after them, so the concatenation of all
+ * the messages is an Arrow IPC stream.
+ *
+ * No tuples are built: the columns are copied from the stream batches.
+ * The search index key fields are streamed too to get the key of the last
+ * row returned, so the index must be unique. The range row count is looked
+ * up in advance like in the delete_until_c_nocmp_arrow.
+ */
 extern "C" int
-update_until_c_batched(box_function_ctx_t *ctx,
-		       const char *args, const char *args_end)
+select_columns_until_c(box_function_ctx_t *ctx, const char *args,
+		       const char *args_end)
 {
 	/* Parse the arguments. */
 	if (mp_typeof(*args) != MP_ARRAY)
 		return ERROR("args not array");
 	uint32_t arg_count = mp_decode_array(&args);
-	if (arg_count != 8)
+	if (arg_count != 9)
 		return ERROR("invalid argument count: %d", arg_count);
 
 	/* Space ID. */
@@ -763,23 +4077,36 @@ update_until_c_batched(box_function_ctx_t *ctx,
 		return ERROR("index ID not uint");
 	uint32_t index_id = mp_decode_uint(&args);
 
-	/* Write index ID. */
-	if (mp_typeof(*args) != MP_UINT)
-		return ERROR("write index ID not uint");
-	uint32_t write_index_id = mp_decode_uint(&args);
-
-	/* Search index key_def. */
-	box_key_def_t *kd;
-	if (args_parse_key_def(&args, &kd) != 0)
+	/* Search index parts. */
+	struct key_def_cache_entry *search_parts;
+	if (args_parse_index_parts_cached(&args, &search_parts) != 0)
+		return -1;
+	uint32_t part_count = search_parts->part_count;
+	const struct arrow_column_codec *codecs[INDEX_PARTS_MAX];
+	if (arrow_column_codecs_by_types(search_parts->types, part_count,
+					 codecs) != 0)
 		return -1;
-	auto kd_guard = make_scoped_guard([kd]() { box_key_def_delete(kd); });
 
-	/* Update ops. */
+	/*
+	 * The selected field numbers, followed by the search index parts
+	 * to get the key to continue after.
+	 */
 	if (mp_typeof(*args) != MP_ARRAY)
-		return ERROR("non-array update ops");
-	const char *ops = args;
-	mp_next(&args); /* Skip the options without checking. */
-	const char *ops_end = args;
+		return ERROR("fields not array");
+	uint32_t field_count = mp_decode_array(&args);
+	if (field_count == 0)
+		return ERROR("no fields to select");
+	uint32_t *fields = (uint32_t *)box_region_alloc(
+		sizeof(*fields) * (field_count + part_count));
+	if (fields == NULL)
+		return ERROR("can't allocate fields array");
+	for (uint32_t i = 0; i < field_count; i++) {
+		if (mp_typeof(*args) != MP_UINT)
+			return ERROR("field number not uint");
+		fields[i] = mp_decode_uint(&args);
+	}
+	memcpy(fields + field_count, search_parts->fields,
+	       sizeof(*fields) * part_count);
 
 	/* The from key. */
 	if (mp_typeof(*args) != MP_ARRAY)
@@ -793,90 +4120,263 @@ update_until_c_batched(box_function_ctx_t *ctx,
 		return ERROR("key is not array");
 	const char *until_key = args;
 	mp_next(&args); /* Skip the key. */
+	const char *until_key_end = args;
 
-	/* The update batch size. */
+	/* The batch row count and the batch count limit. */
 	if (mp_typeof(*args) != MP_UINT)
 		return ERROR("batch size not uint");
 	uint32_t batch_size = mp_decode_uint(&args);
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("batch limit not uint");
+	uint64_t batch_limit = mp_decode_uint(&args);
+	if (batch_limit == 0)
+		return ERROR("batch limit is zero");
+
+	/* The key to continue after (nil to start from the from key). */
+	const char *after = NULL;
+	const char *after_end = NULL;
+	if (mp_typeof(*args) == MP_ARRAY) {
+		after = args;
+		mp_next(&args); /* Skip the key. */
+		after_end = args;
+	} else if (mp_typeof(*args) == MP_NIL) {
+		mp_decode_nil(&args);
+	} else {
+		return ERROR("after key not array or nil");
+	}
 
 	/* That's it. */
 	if (args != args_end)
 		return ERROR("bigger input than expected");
 
-	/* Allocate the update key buffer. */
-	size_t region_svp = box_region_used();
-	auto region_guard = make_scoped_guard([region_svp]() {
-		box_region_truncate(region_svp);
-	});
-	char **keys = (char **)box_region_alloc(batch_size * sizeof(*keys));
-	char **key_ends =
-		(char **)box_region_alloc(batch_size * sizeof(*key_ends));
-	int keys_size = 0;
-
-	/* Next memory is for the extracted keys. */
-	size_t region_keys_svp = box_region_used();
+	/* Get the row count of the rest of the range. */
+	ssize_t rows_remained;
+	if (after == NULL) {
+		rows_remained = index_range_row_count(space_id, index_id,
+						      from_key, from_key_end,
+						      until_key, until_key_end);
+	} else {
+		rows_remained = box_index_count(space_id, index_id, ITER_LT,
+						until_key, until_key_end);
+		ssize_t count_before = box_index_count(space_id, index_id,
+						       ITER_LE, after,
+						       after_end);
+		if (rows_remained < 0 || count_before < 0)
+			return ERROR("can't count the range rows");
+		rows_remained = MAX(rows_remained - count_before, 0);
+	}
+	if (rows_remained < 0)
+		return -1;
 
-	/* Create the search index iterator. */
-	box_iterator_t *it = box_index_iterator(space_id, index_id, ITER_GE,
-						from_key, from_key_end);
-	if (it == NULL)
-		return ERROR("couldn't create an iterator");
-	auto it_guard = make_scoped_guard([it]() { box_iterator_free(it); });
+	/* Create the search index scanner of the fields. */
+	struct ArrowArrayStream stream = {};
+	box_arrow_options_t *options = box_arrow_options_new();
+	auto arrow_options_guard = make_scoped_guard([options]() {
+		box_arrow_options_delete(options);
+	});
+	box_arrow_options_set_iterator(options,
+				       after == NULL ? ITER_GE : ITER_GT);
+	box_arrow_options_set_batch_row_count(options, batch_size);
+	if (box_index_arrow_stream(space_id, index_id,
+				   field_count + part_count, fields,
+				   after == NULL ? from_key : after,
+				   after == NULL ? from_key_end : after_end,
+				   options, &stream) != 0)
+		return ERROR("couldn't create an Arrow stream");
+	auto it_guard = make_scoped_guard([&stream]() {
+		if (stream.release != NULL)
+			stream.release(&stream);
+	});
+	struct ArrowSchema schema = {};
+	if (stream.get_schema(&stream, &schema) != 0)
+		return ERROR("couldn't get the stream schema");
+	auto schema_guard = make_scoped_guard([&schema]() {
+		if (schema.release != NULL)
+			schema.release(&schema);
+	});
+	if (schema.n_children != field_count + part_count)
+		return ERROR("unexpected n_children: %lld",
+			     (long long)schema.n_children);
+	for (uint32_t i = 0; i < field_count; i++) {
+		const char *format = schema.children[i]->format;
+		if (!arrow_ipc_format_is_supported(format))
+			return ERROR("unsupported Arrow format of field %u: "
+				     "%s", fields[i], format);
+	}
 
-	/* Iterate over the space and update tuple batches. */
-	box_tuple_t *tuple;
-	for (;;) {
-		/* Get the next tuple. */
-		if (box_iterator_next(it, &tuple) != 0)
-			return ERROR("couldn't advance the iterator");
-		if (tuple == NULL)
-			return ERROR("unexpected end of space");
+	/* The selected fields only, the key columns are not returned. */
+	struct ArrowSchema fields_schema = schema;
+	fields_schema.n_children = field_count;
 
-		/* The until key reached - stop update. */
-		if (box_tuple_compare_with_key(tuple, until_key, kd) == 0)
-			break;
+	/* Return the schema if it's the first chunk. */
+	struct arrow_ipc_writer *writer = &select_columns_writer;
+	if (after == NULL) {
+		select_columns_message_begin(writer);
+		if (arrow_ipc_write_schema(writer, &fields_schema) != 0)
+			return ERROR("couldn't encode the Arrow schema");
+		if (select_columns_message_return(ctx, writer) != 0)
+			return -1;
+	}
 
-		/* Extract the tuple key and save it. */
-		uint32_t key_size;
-		char *key = box_tuple_extract_key(tuple, space_id,
-						  write_index_id, &key_size);
-		if (key == NULL)
-			return ERROR("couldn't extract key from tuple");
-		keys[keys_size] = key;
-		key_ends[keys_size++] = key + key_size;
+	/* Return up to batch_limit range batches. */
+	uint64_t batch_count = 0;
+	while (rows_remained > 0 && batch_count < batch_limit) {
+		size_t region_svp = box_region_used();
+		auto region_guard = make_scoped_guard([region_svp]() {
+			box_region_truncate(region_svp);
+		});
+		struct ArrowArray array = {};
+		if (stream.get_next(&stream, &array) != 0)
+			return ERROR("couldn't read the next stream batch");
+		auto array_guard = make_scoped_guard([&array]() {
+			if (array.release != NULL)
+				array.release(&array);
+		});
+		if (array.release == NULL || array.n_children == 0) {
+			rows_remained = 0;
+			break; /* End of data. */
+		}
+		int64_t count = MIN(array.length, rows_remained);
+		struct ArrowArray fields_array = array;
+		fields_array.n_children = field_count;
+		select_columns_message_begin(writer);
+		if (arrow_ipc_write_batch(writer, &fields_schema, &fields_array,
+					  count) != 0)
+			return ERROR("couldn't encode the Arrow batch");
+		if (select_columns_message_return(ctx, writer) != 0)
+			return -1;
+		rows_remained -= count;
+		batch_count++;
+		if (rows_remained == 0 || batch_count < batch_limit)
+			continue;
 
-		/* Update the batch if collected enough. */
-		if (keys_size == batch_size) {
-			for (int i = 0; i < batch_size; i++) {
-				if (box_update(space_id, write_index_id,
-					       keys[i], key_ends[i],
-					       ops, ops_end, 1, &tuple) != 0) {
-					return ERROR("couldn't update a tuple");
-				}
-			}
-			keys_size = 0;
-			box_region_truncate(region_keys_svp);
+		/*
+		 * Return the key of the last row to continue after. Only
+		 * that row is encoded: the key columns are sliced to it.
+		 */
+		struct ArrowArray *key_columns = (struct ArrowArray *)
+			box_region_alloc(sizeof(*key_columns) * part_count);
+		struct ArrowArray **key_children = (struct ArrowArray **)
+			box_region_alloc(sizeof(*key_children) * part_count);
+		if (key_columns == NULL || key_children == NULL)
+			return ERROR("can't allocate the continuation key");
+		for (uint32_t i = 0; i < part_count; i++) {
+			key_columns[i] = *array.children[field_count + i];
+			key_columns[i].offset += count - 1;
+			key_columns[i].length = 1;
+			key_children[i] = &key_columns[i];
 		}
+		struct ArrowArray key_array = array;
+		key_array.length = 1;
+		key_array.n_children = part_count;
+		key_array.children = key_children;
+		char **keys;
+		if (arrow_array_transpose(&key_array, codecs, 1, &keys) != 0)
+			return -1;
+		return box_return_mp(ctx, keys[0], keys[1]);
 	}
 
-	/* Handle the remained collected keys not forming a full batch. */
-	for (int i = 0; i < keys_size; i++) {
-		if (box_update(space_id, write_index_id, keys[i], key_ends[i],
-			       ops, ops_end, 1, &tuple) != 0) {
-			return ERROR("couldn't update a tuple in tail");
-		}
+	/* The range is over: return the end of stream. */
+	select_columns_message_begin(writer);
+	if (arrow_ipc_write_eos(writer) != 0)
+		return ERROR("couldn't encode the Arrow end of stream");
+	if (select_columns_message_return(ctx, writer) != 0)
+		return -1;
+	char nil[1];
+	return box_return_mp(ctx, nil, mp_encode_nil(nil));
+}
+
+/* Maximum count of the operations of a bulk_update_c template. */
+#define BULK_UPDATE_OPS_MAX 16
+
+/* Maximum count of the bulk_update_c value columns. */
+#define BULK_UPDATE_COLUMNS_MAX 16
+
+/*
+ * A compiled bulk update operation: the [op, field, part of the encoded
+ * template operation (used as is) and the value column to complete it.
+ */
+struct bulk_update_op {
+	const char *prefix;
+	uint32_t prefix_size;
+	uint32_t column;
+};
+
+/*
+ * Compile the update template: an array of [op, field, column] where the
+ * column is the 1-based number of the value column to take the operation
+ * value from.
+ */
+static int
+args_parse_bulk_update_ops(const char **args, struct bulk_update_op *ops,
+			   uint32_t *op_count, uint32_t column_count)
+{
+	if (mp_typeof(**args) != MP_ARRAY)
+		return ERROR("ops not array");
+	*op_count = mp_decode_array(args);
+	if (*op_count == 0 || *op_count > BULK_UPDATE_OPS_MAX)
+		return ERROR("invalid op count: %u", *op_count);
+	for (uint32_t i = 0; i < *op_count; i++) {
+		const char *prefix = *args;
+		if (mp_typeof(**args) != MP_ARRAY || mp_decode_array(args) != 3)
+			return ERROR("op is not [op, field, column]");
+		if (mp_typeof(**args) != MP_STR)
+			return ERROR("op not str");
+		mp_next(args); /* Skip the op. */
+		if (mp_typeof(**args) != MP_UINT && mp_typeof(**args) != MP_STR)
+			return ERROR("op field not uint or str");
+		mp_next(args); /* Skip the field. */
+		ops[i].prefix = prefix;
+		ops[i].prefix_size = *args - prefix;
+		if (mp_typeof(**args) != MP_UINT)
+			return ERROR("op column not uint");
+		uint64_t column = mp_decode_uint(args);
+		if (column == 0 || column > column_count)
+			return ERROR("invalid op column: %llu",
+				     (unsigned long long)column);
+		ops[i].column = column - 1;
 	}
 	return 0;
 }
 
+/* The update operations buffer of bulk_update_c, reused between rows. */
+struct bulk_update_ops_buf {
+	char *data;
+	size_t capacity;
+};
+
+static int
+bulk_update_ops_buf_reserve(struct bulk_update_ops_buf *buf, size_t size)
+{
+	if (size <= buf->capacity)
+		return 0;
+	size_t capacity = MAX(buf->capacity * 2, size);
+	char *data = (char *)realloc(buf->data, capacity);
+	if (data == NULL)
+		return ERROR("can't allocate the update operations");
+	buf->data = data;
+	buf->capacity = capacity;
+	return 0;
+}
+
+/*
+ * Update each row of the columns with its own values. The key column holds
+ * the write index keys (single part key values or key arrays), the value
+ * columns hold the operation values. The operations of a row are generated
+ * from the template compiled once: the encoded [op, field, parts of the
+ * template are followed by the raw row values. The rows are applied by
+ * batches sorted in the write index order if the key parts are given: the
+ * types of the key column parts ({0, type0, 1, type1, ...}), they must be
+ * the write index part types.
+ */
 extern "C" int
-process_until_c(box_function_ctx_t *ctx, const char *args, const char *args_end)
+bulk_update_c(box_function_ctx_t *ctx, const char *args, const char *args_end)
 {
 	/* Parse the arguments. */
 	if (mp_typeof(*args) != MP_ARRAY)
 		return ERROR("args not array");
 	uint32_t arg_count = mp_decode_array(&args);
-	if (arg_count != 5)
+	if (arg_count != 6)
 		return ERROR("invalid argument count: %d", arg_count);
 
 	/* Space ID. */
@@ -884,61 +4384,161 @@ process_until_c(box_function_ctx_t *ctx, const char *args, const char *args_end)
 		return ERROR("space ID not uint");
 	uint32_t space_id = mp_decode_uint(&args);
 
-	/* Search index ID. */
+	/* Write index ID. */
 	if (mp_typeof(*args) != MP_UINT)
-		return ERROR("index ID not uint");
-	uint32_t index_id = mp_decode_uint(&args);
+		return ERROR("write index ID not uint");
+	uint32_t write_index_id = mp_decode_uint(&args);
 
-	/* Search index key_def. */
-	box_key_def_t *kd;
-	if (args_parse_key_def(&args, &kd) != 0)
+	/* The key column parts to sort the batches by (nil to not sort). */
+	struct key_def_cache_entry *key_parts = NULL;
+	if (mp_typeof(*args) == MP_NIL)
+		mp_decode_nil(&args);
+	else if (args_parse_index_parts_cached(&args, &key_parts) != 0)
 		return -1;
-	auto kd_guard = make_scoped_guard([kd]() { box_key_def_delete(kd); });
 
-	/* The from key. */
-	if (mp_typeof(*args) != MP_ARRAY)
-		return ERROR("key is not array");
-	const char *from_key = args;
-	mp_next(&args); /* Skip the key. */
-	const char *from_key_end = args;
+	/* The template is parsed after the columns: it refers to them. */
+	const char *ops_template = args;
+	mp_next(&args); /* Skip the template. */
 
-	/* The until key. */
+	/* The key column and the value columns. */
 	if (mp_typeof(*args) != MP_ARRAY)
-		return ERROR("key is not array");
-	const char *until_key = args;
-	mp_next(&args); /* Skip the key. */
+		return ERROR("columns not array");
+	uint32_t column_count = mp_decode_array(&args);
+	if (column_count < 2 || column_count > BULK_UPDATE_COLUMNS_MAX + 1)
+		return ERROR("invalid column count: %u", column_count);
+	const char *cursors[BULK_UPDATE_COLUMNS_MAX + 1];
+	uint32_t row_count = 0;
+	for (uint32_t i = 0; i < column_count; i++) {
+		if (mp_typeof(*args) != MP_ARRAY)
+			return ERROR("column not array");
+		cursors[i] = args;
+		uint32_t count = mp_decode_array(&cursors[i]);
+		if (i != 0 && count != row_count)
+			return ERROR("columns of different length");
+		row_count = count;
+		mp_next(&args); /* Skip the column. */
+	}
+	const char **key_cursor = &cursors[0];
+	const char **value_cursors = &cursors[1];
+	uint32_t value_count = column_count - 1;
+
+	/* The update batch size. */
+	if (mp_typeof(*args) != MP_UINT)
+		return ERROR("batch size not uint");
+	uint32_t batch_size = mp_decode_uint(&args);
+	if (batch_size == 0)
+		return ERROR("batch size is zero");
 
 	/* That's it. */
 	if (args != args_end)
 		return ERROR("bigger input than expected");
 
-	/* Create the search index iterator. */
-	box_iterator_t *it = box_index_iterator(space_id, index_id, ITER_GE,
-						from_key, from_key_end);
-	if (it == NULL)
-		return ERROR("couldn't create an iterator");
-	auto it_guard = make_scoped_guard([it]() { box_iterator_free(it); });
+	/* Compile the update template. */
+	struct bulk_update_op ops[BULK_UPDATE_OPS_MAX];
+	uint32_t op_count;
+	if (args_parse_bulk_update_ops(&ops_template, ops, &op_count,
+				       value_count) != 0)
+		return -1;
 
-	/* Iterate over the space and delete tuples. */
-	box_tuple_t *tuple;
-	for (;;) {
-		/* Savepoint memory for the extracted key. */
-		size_t region_svp = box_region_used();
-		auto region_guard = make_scoped_guard([region_svp]() {
-			box_region_truncate(region_svp);
-		});
+	/* Allocate the batch keys bounds and the row values. */
+	size_t region_svp = box_region_used();
+	auto region_guard = make_scoped_guard([region_svp]() {
+		box_region_truncate(region_svp);
+	});
+	char **keys = (char **)box_region_alloc(batch_size * sizeof(*keys));
+	char **key_ends =
+		(char **)box_region_alloc(batch_size * sizeof(*key_ends));
+	const char **values = (const char **)box_region_alloc(
+		(size_t)batch_size * value_count * sizeof(*values));
+	if (keys == NULL || key_ends == NULL || values == NULL)
+		return ERROR("can't allocate a batch");
+	struct key_buf key_data = {};
+	auto key_data_guard = make_scoped_guard([&key_data]() {
+		key_buf_destroy(&key_data);
+	});
+	struct bulk_update_ops_buf ops_buf = {};
+	auto ops_buf_guard = make_scoped_guard([&ops_buf]() {
+		free(ops_buf.data);
+	});
 
-		/* Get the next tuple. */
-		if (box_iterator_next(it, &tuple) != 0)
-			return ERROR("couldn't advance the iterator");
-		if (tuple == NULL)
-			return ERROR("unexpected end of space");
+	/*
+	 * Sort the batches if requested. The keys are radix sorted or
+	 * compared encoded, only the keys of other types need key tuples.
+	 */
+	struct key_batch_sorter sorter = {};
+	auto sorter_guard = make_scoped_guard([&sorter]() {
+		key_batch_sorter_destroy(&sorter);
+	});
+	if (key_parts != NULL &&
+	    (key_parts_check_index(key_parts, space_id, write_index_id) != 0 ||
+	     key_batch_sorter_create(&sorter, space_id, write_index_id, true,
+				     batch_size) != 0))
+		return -1;
+	box_tuple_format_t *key_format = box_tuple_format_default();
 
-		/* The until key reached - stop processing.*/
-		if (box_tuple_compare_with_key(tuple, until_key, kd) == 0)
-			break;
+	/* Next memory is used by the requests of a batch. */
+	size_t region_batch_svp = box_region_used();
 
-		/* Process the tuple. */
+	for (uint32_t row = 0; row < row_count; row += batch_size) {
+		uint32_t count = MIN(batch_size, row_count - row);
+
+		/* Collect the batch keys and the positions of the values. */
+		key_buf_reset(&key_data);
+		for (uint32_t i = 0; i < count; i++) {
+			const char *key = *key_cursor;
+			mp_next(key_cursor);
+			if (key_batch_sorter_check_key(&sorter, key) != 0)
+				return -1;
+			if (key_buf_add_key(&key_data, key, *key_cursor) != 0)
+				return -1;
+			for (uint32_t j = 0; j < value_count; j++) {
+				values[i * value_count + j] = value_cursors[j];
+				mp_next(&value_cursors[j]);
+			}
+		}
+		key_buf_export(&key_data, keys, key_ends);
+		if (key_parts != NULL && !sorter.use_radix &&
+		    !sorter.use_key_cmp) {
+			for (uint32_t i = 0; i < count; i++) {
+				box_tuple_t *key_tuple = box_tuple_new(
+					key_format, keys[i], key_ends[i]);
+				if (key_tuple == NULL)
+					return ERROR("couldn't create a key "
+						     "tuple");
+				key_batch_sorter_add(&sorter, key_tuple);
+			}
+		}
+		key_batch_sorter_sort(&sorter, keys, count);
+
+		/* Generate the operations of each row and apply them. */
+		for (uint32_t i = 0; i < count; i++) {
+			int k = key_batch_sorter_at(&sorter, i);
+			const char **row_values = &values[k * value_count];
+			const char *value_ends[BULK_UPDATE_OPS_MAX];
+			size_t size = mp_sizeof_array(op_count);
+			for (uint32_t j = 0; j < op_count; j++) {
+				value_ends[j] = row_values[ops[j].column];
+				mp_next(&value_ends[j]);
+				size += ops[j].prefix_size + (value_ends[j] -
+					row_values[ops[j].column]);
+			}
+			if (bulk_update_ops_buf_reserve(&ops_buf, size) != 0)
+				return -1;
+			char *data = mp_encode_array(ops_buf.data, op_count);
+			for (uint32_t j = 0; j < op_count; j++) {
+				const char *value = row_values[ops[j].column];
+				memcpy(data, ops[j].prefix, ops[j].prefix_size);
+				data += ops[j].prefix_size;
+				memcpy(data, value, value_ends[j] - value);
+				data += value_ends[j] - value;
+			}
+			if (box_update(space_id, write_index_id, keys[k],
+				       key_ends[k], ops_buf.data, data, 1,
+				       NULL) != 0)
+				return ERROR("couldn't update a tuple");
+		}
+		key_batch_sorter_reset(&sorter);
+		box_region_truncate(region_batch_svp);
 	}
 	return 0;
 }